@@ -0,0 +1,314 @@
+#include "beam_search.h"
+#include <string.h> // For memcpy()
+#include <math.h> // For log()
+#include <pthread.h>
+
+
+/**
+ * Create a beam search workspace.
+ * @param beam_width number of hypotheses kept after every step
+ * @param max_length maximum length of sequence to generate
+ * @param results_capacity number of best sequences to return
+ * @return newly allocated BeamSearch, NULL in case of allocation failure
+ */
+BeamSearch *create_beam_search(int beam_width, int max_length,
+                               int results_capacity) {
+    if (beam_width < 1 || max_length < 1 || results_capacity < 1) {
+        return NULL;
+    }
+    BeamSearch *beam_search = calloc(1, sizeof(BeamSearch));
+    if (!beam_search) {
+        return NULL;
+    }
+    beam_search->beam_width = beam_width;
+    beam_search->max_length = max_length;
+    beam_search->results_capacity = results_capacity;
+    int rows = 2 * beam_width + results_capacity;
+    beam_search->storage = malloc(sizeof(MarkovNode *) * rows * max_length);
+    beam_search->beam = malloc(sizeof(BeamHypothesis) * beam_width);
+    beam_search->next_beam = malloc(sizeof(BeamHypothesis) * beam_width);
+    beam_search->results = malloc(sizeof(BeamHypothesis) * results_capacity);
+    beam_search->candidates = malloc(sizeof(BeamCandidate) * beam_width);
+    if (!beam_search->storage || !beam_search->beam ||
+        !beam_search->next_beam || !beam_search->results ||
+        !beam_search->candidates) {
+        free_beam_search(&beam_search);
+        return NULL;
+    }
+    // every hypothesis owns a row of the storage, rows are only swapped
+    MarkovNode **row = beam_search->storage;
+    for (int i = 0; i < beam_width; i++, row += max_length) {
+        beam_search->beam[i].sequence = row;
+    }
+    for (int i = 0; i < beam_width; i++, row += max_length) {
+        beam_search->next_beam[i].sequence = row;
+    }
+    for (int i = 0; i < results_capacity; i++, row += max_length) {
+        beam_search->results[i].sequence = row;
+    }
+    return beam_search;
+}
+
+
+/**
+ * Free beam_search and all of it's content from memory.
+ * @param beam_search workspace to free
+ */
+void free_beam_search(BeamSearch **ptr_beam_search) {
+    BeamSearch *beam_search = *ptr_beam_search;
+    if (!beam_search) {
+        return;
+    }
+    free(beam_search->storage);
+    free(beam_search->beam);
+    free(beam_search->next_beam);
+    free(beam_search->results);
+    free(beam_search->candidates);
+    free(beam_search);
+    *ptr_beam_search = NULL;
+}
+
+
+/**
+ * Check whether a sequence with the given log-probability can still be one of
+ * the results.
+ */
+static bool can_be_result(BeamSearch *beam_search, double log_prob) {
+    return beam_search->results_count < beam_search->results_capacity ||
+           log_prob > beam_search->results[beam_search->results_count - 1]
+                   .log_prob;
+}
+
+
+/**
+ * Add a finished sequence (parent followed by markov_node) to the results,
+ * dropping the least probable result if there is no room.
+ */
+static void add_result(BeamSearch *beam_search, BeamHypothesis *parent,
+                       MarkovNode *markov_node, double log_prob) {
+    BeamHypothesis *results = beam_search->results;
+    int last = beam_search->results_count;
+    if (last == beam_search->results_capacity) {
+        last--;
+    } else {
+        beam_search->results_count++;
+    }
+    BeamHypothesis result = results[last];
+    int length = 0;
+    if (parent) {
+        memcpy(result.sequence, parent->sequence,
+               sizeof(MarkovNode *) * parent->length);
+        length = parent->length;
+    }
+    result.sequence[length] = markov_node;
+    result.length = length + 1;
+    result.log_prob = log_prob;
+    int i = last;
+    for (; i > 0 && results[i - 1].log_prob < log_prob; i--) {
+        results[i] = results[i - 1];
+    }
+    results[i] = result;
+}
+
+
+/**
+ * Check whether the sequence ends at the given state.
+ */
+static bool is_finished(MarkovChain *markov_chain, MarkovNode *markov_node,
+                        int length, int max_length) {
+    return length == max_length || markov_node->counter_lst_size == 0 ||
+           markov_chain->is_last(markov_node->data);
+}
+
+
+/**
+ * Insert a candidate into the candidates, which are kept sorted from the most
+ * probable one, dropping the least probable candidate if there is no room.
+ * @return false if the candidate is not probable enough to be inserted
+ */
+static bool insert_candidate(BeamSearch *beam_search, int candidates_count,
+                             BeamCandidate candidate) {
+    BeamCandidate *candidates = beam_search->candidates;
+    int i = candidates_count;
+    if (candidates_count == beam_search->beam_width) {
+        if (candidates[i - 1].log_prob >= candidate.log_prob) {
+            return false;
+        }
+        i--;
+    }
+    for (; i > 0 && candidates[i - 1].log_prob < candidate.log_prob; i--) {
+        candidates[i] = candidates[i - 1];
+    }
+    candidates[i] = candidate;
+    return true;
+}
+
+
+/**
+ * Collect the beam_width most probable successors of all the hypotheses in
+ * the beam. The counter lists are sorted by frequency, so the successors of a
+ * hypothesis are checked only until one of them doesn't make it.
+ * @return number of candidates
+ */
+static int collect_candidates(BeamSearch *beam_search) {
+    int candidates_count = 0;
+    for (int i = 0; i < beam_search->beam_size; i++) {
+        BeamHypothesis *hypothesis = &beam_search->beam[i];
+        MarkovNode *last = hypothesis->sequence[hypothesis->length - 1];
+        double log_freq_sum = log(last->freq_sum);
+        for (int j = 0; j < last->counter_lst_size; j++) {
+            double log_prob = hypothesis->log_prob +
+                              log(last->counter_list[j].frequency) -
+                              log_freq_sum;
+            if (!can_be_result(beam_search, log_prob) ||
+                !insert_candidate(beam_search, candidates_count,
+                                  (BeamCandidate) {
+                                          i, last->counter_list[j].markov_node,
+                                          log_prob})) {
+                break;
+            }
+            if (candidates_count < beam_search->beam_width) {
+                candidates_count++;
+            }
+        }
+    }
+    return candidates_count;
+}
+
+
+/**
+ * Find the most probable sequences that start with first_node, scored by the
+ * sum of log(frequency / freq_sum) over their transitions. A sequence is
+ * finished by a last state, a state without successors, or max_length.
+ * @param beam_search workspace, holds the results afterwards
+ * @param markov_chain
+ * @param first_node markov_node to start with
+ * @return number of sequences in beam_search->results, sorted from the most
+ * probable one.
+ */
+int beam_search(BeamSearch *beam_search, MarkovChain *markov_chain,
+                MarkovNode *first_node) {
+    beam_search->results_count = 0;
+    beam_search->beam_size = 0;
+    if (!markov_chain || !first_node) {
+        return 0;
+    }
+    if (is_finished(markov_chain, first_node, 1, beam_search->max_length)) {
+        add_result(beam_search, NULL, first_node, 0);
+        return beam_search->results_count;
+    }
+    beam_search->beam[0].sequence[0] = first_node;
+    beam_search->beam[0].length = 1;
+    beam_search->beam[0].log_prob = 0;
+    beam_search->beam_size = 1;
+
+    while (beam_search->beam_size > 0) {
+        int candidates_count = collect_candidates(beam_search);
+        int next_size = 0;
+        for (int i = 0; i < candidates_count; i++) {
+            BeamCandidate *candidate = &beam_search->candidates[i];
+            if (!can_be_result(beam_search, candidate->log_prob)) {
+                break;
+            }
+            BeamHypothesis *parent = &beam_search->beam[candidate->parent];
+            int length = parent->length + 1;
+            if (is_finished(markov_chain, candidate->markov_node, length,
+                            beam_search->max_length)) {
+                add_result(beam_search, parent, candidate->markov_node,
+                           candidate->log_prob);
+                continue;
+            }
+            BeamHypothesis *next = &beam_search->next_beam[next_size++];
+            memcpy(next->sequence, parent->sequence,
+                   sizeof(MarkovNode *) * parent->length);
+            next->sequence[parent->length] = candidate->markov_node;
+            next->length = length;
+            next->log_prob = candidate->log_prob;
+        }
+        BeamHypothesis *tmp = beam_search->beam;
+        beam_search->beam = beam_search->next_beam;
+        beam_search->next_beam = tmp;
+        beam_search->beam_size = next_size;
+    }
+    return beam_search->results_count;
+}
+
+
+typedef struct BeamThreadArgs {
+    BeamSearch **beam_searches;
+    MarkovChain *markov_chain;
+    MarkovNode **first_nodes;
+    int count;
+    int first;  // index of the first start of this thread
+    int step;   // number of threads
+} BeamThreadArgs;
+
+static void *beam_search_thread(void *ptr_args) {
+    BeamThreadArgs *args = ptr_args;
+    for (int i = args->first; i < args->count; i += args->step) {
+        beam_search(args->beam_searches[i], args->markov_chain,
+                    args->first_nodes[i]);
+    }
+    return NULL;
+}
+
+
+/**
+ * Run a beam search from every one of first_nodes, spread across threads.
+ * The chain is only read, so it must not be changed meanwhile.
+ * @param beam_searches one workspace per first node, holds it's results
+ * @param markov_chain
+ * @param first_nodes markov_nodes to start with
+ * @param count number of first nodes
+ * @param threads_count number of threads to search with
+ * @return true on success, false if a thread could not be created
+ */
+bool beam_search_many(BeamSearch **beam_searches, MarkovChain *markov_chain,
+                      MarkovNode **first_nodes, int count, int threads_count) {
+    if (threads_count > count) {
+        threads_count = count;
+    }
+    if (threads_count <= 1) {
+        for (int i = 0; i < count; i++) {
+            beam_search(beam_searches[i], markov_chain, first_nodes[i]);
+        }
+        return true;
+    }
+    pthread_t *threads = malloc(sizeof(pthread_t) * threads_count);
+    BeamThreadArgs *args = malloc(sizeof(BeamThreadArgs) * threads_count);
+    if (!threads || !args) {
+        free(threads);
+        free(args);
+        return false;
+    }
+    bool success = true;
+    int started = 0;
+    for (; started < threads_count; started++) {
+        args[started] = (BeamThreadArgs) {beam_searches, markov_chain,
+                                          first_nodes, count, started,
+                                          threads_count};
+        if (pthread_create(&threads[started], NULL, beam_search_thread,
+                           &args[started]) != 0) {
+            success = false;
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(args);
+    return success;
+}
+
+
+/**
+ * Print a sequence found by a beam search.
+ * @param markov_chain the chain the sequence was generated from
+ * @param hypothesis sequence to print
+ */
+void print_hypothesis(MarkovChain *markov_chain, BeamHypothesis *hypothesis) {
+    for (int i = 0; i < hypothesis->length; i++) {
+        markov_chain->print_func(hypothesis->sequence[i]->data);
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef _BEAM_SEARCH_H
+#define _BEAM_SEARCH_H
+
+#include "markov_chain.h"
+
+/**
+ * A sequence of states and the log-probability of generating it from it's
+ * first state.
+ */
+typedef struct BeamHypothesis {
+    MarkovNode **sequence; // points into the storage of the BeamSearch
+    int length;
+    double log_prob;
+} BeamHypothesis;
+
+typedef struct BeamCandidate {
+    int parent;  // index of the expanded hypothesis in the current beam
+    MarkovNode *markov_node;
+    double log_prob;
+} BeamCandidate;
+
+/**
+ * Fixed capacity workspace of a beam search. All the memory is allocated when
+ * it is created, so searching does no heap allocation and a workspace can be
+ * reused for any number of searches.
+ */
+typedef struct BeamSearch {
+    int beam_width;
+    int max_length;
+    int results_capacity;
+    MarkovNode **storage;
+    BeamHypothesis *beam;        // hypotheses that are still being extended
+    BeamHypothesis *next_beam;
+    BeamCandidate *candidates;   // most probable successors of the beam
+    BeamHypothesis *results;     // best finished sequences, by log_prob
+    int beam_size;
+    int results_count;
+} BeamSearch;
+
+/**
+ * Create a beam search workspace.
+ * @param beam_width number of hypotheses kept after every step
+ * @param max_length maximum length of sequence to generate
+ * @param results_capacity number of best sequences to return
+ * @return newly allocated BeamSearch, NULL in case of allocation failure
+ */
+BeamSearch *create_beam_search(int beam_width, int max_length,
+                               int results_capacity);
+
+/**
+ * Free beam_search and all of it's content from memory.
+ * @param beam_search workspace to free
+ */
+void free_beam_search(BeamSearch **beam_search);
+
+/**
+ * Find the most probable sequences that start with first_node, scored by the
+ * sum of log(frequency / freq_sum) over their transitions. A sequence is
+ * finished by a last state, a state without successors, or max_length.
+ * @param beam_search workspace, holds the results afterwards
+ * @param markov_chain
+ * @param first_node markov_node to start with
+ * @return number of sequences in beam_search->results, sorted from the most
+ * probable one.
+ */
+int beam_search(BeamSearch *beam_search, MarkovChain *markov_chain,
+                MarkovNode *first_node);
+
+/**
+ * Run a beam search from every one of first_nodes, spread across threads.
+ * The chain is only read, so it must not be changed meanwhile.
+ * @param beam_searches one workspace per first node, holds it's results
+ * @param markov_chain
+ * @param first_nodes markov_nodes to start with
+ * @param count number of first nodes
+ * @param threads_count number of threads to search with
+ * @return true on success, false if a thread could not be created
+ */
+bool beam_search_many(BeamSearch **beam_searches, MarkovChain *markov_chain,
+                      MarkovNode **first_nodes, int count, int threads_count);
+
+/**
+ * Print a sequence found by a beam search.
+ * @param markov_chain the chain the sequence was generated from
+ * @param hypothesis sequence to print
+ */
+void print_hypothesis(MarkovChain *markov_chain, BeamHypothesis *hypothesis);
+
+#endif /* _BEAM_SEARCH_H */
@@ -0,0 +1,290 @@
+#include "concurrent_chain.h"
+
+#define FIRST_CHUNK_CAPACITY 2
+
+/* Atomic accesses use the __atomic builtins of gcc, since the chain is built
+ * as C99. A value published with a release store is read with an acquire
+ * load, so everything written before it is seen with it. */
+#define LOAD_ACQUIRE(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+
+
+/**
+ * Create an empty concurrent chain. The functions of the data are set by the
+ * caller before the chain is used.
+ * @param buckets_count minimal number of buckets of the states hash table
+ * @return newly allocated chain, NULL in case of allocation failure
+ */
+ConcurrentMarkovChain *create_concurrent_chain(int buckets_count) {
+    ConcurrentMarkovChain *markov_chain = calloc(1,
+                                                 sizeof(ConcurrentMarkovChain));
+    if (!markov_chain) {
+        return NULL;
+    }
+    markov_chain->buckets_count = 1;
+    while (markov_chain->buckets_count < buckets_count &&
+           markov_chain->buckets_count < (1 << 30)) {
+        markov_chain->buckets_count *= 2;
+    }
+    markov_chain->buckets = calloc(markov_chain->buckets_count,
+                                   sizeof(ConcurrentNode *));
+    if (!markov_chain->buckets) {
+        free(markov_chain);
+        return NULL;
+    }
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        pthread_mutex_init(&markov_chain->locks[i], NULL);
+    }
+    return markov_chain;
+}
+
+
+/**
+ * Free markov_chain and all of it's content from memory. No other thread may
+ * use the chain meanwhile.
+ * @param markov_chain chain to free
+ */
+void free_concurrent_chain(ConcurrentMarkovChain **ptr_chain) {
+    ConcurrentMarkovChain *markov_chain = *ptr_chain;
+    if (!markov_chain) {
+        return;
+    }
+    for (int i = 0; i < markov_chain->buckets_count; i++) {
+        ConcurrentNode *node = markov_chain->buckets[i];
+        while (node) {
+            ConcurrentNode *next_node = node->next_in_bucket;
+            CounterChunk *chunk = node->first_chunk;
+            while (chunk) {
+                CounterChunk *next_chunk = chunk->next;
+                free(chunk);
+                chunk = next_chunk;
+            }
+            markov_chain->free_data(node->data);
+            free(node);
+            node = next_node;
+        }
+    }
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&markov_chain->locks[i]);
+    }
+    free(markov_chain->buckets);
+    free(markov_chain);
+    *ptr_chain = NULL;
+}
+
+
+/**
+ * Search data_ptr in a bucket, from node until stop (not including).
+ * @return the state of data_ptr, NULL if it is not there
+ */
+static ConcurrentNode *find_in_bucket(ConcurrentMarkovChain *markov_chain,
+                                      ConcurrentNode *node,
+                                      ConcurrentNode *stop, void *data_ptr,
+                                      uint64_t hash) {
+    for (; node != stop; node = node->next_in_bucket) {
+        if (node->hash == hash &&
+            markov_chain->comp_func(node->data, data_ptr) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Find the state of data_ptr in the chain. Safe to call from any thread.
+ * @return the state, NULL if data_ptr is not in the chain
+ */
+ConcurrentNode *get_concurrent_node(ConcurrentMarkovChain *markov_chain,
+                                    void *data_ptr) {
+    uint64_t hash = markov_chain->hash_func(data_ptr);
+    ConcurrentNode **bucket = &markov_chain->buckets[
+            hash & (markov_chain->buckets_count - 1)];
+    return find_in_bucket(markov_chain, LOAD_ACQUIRE(bucket), NULL, data_ptr,
+                          hash);
+}
+
+
+/**
+ * Find the state of data_ptr, or add a new one for it. Safe to call from any
+ * thread; if two threads add the same data, both get the same state.
+ * @return the state, NULL in case of allocation failure
+ */
+ConcurrentNode *add_concurrent_node(ConcurrentMarkovChain *markov_chain,
+                                    void *data_ptr) {
+    uint64_t hash = markov_chain->hash_func(data_ptr);
+    ConcurrentNode **bucket = &markov_chain->buckets[
+            hash & (markov_chain->buckets_count - 1)];
+    ConcurrentNode *head = LOAD_ACQUIRE(bucket);
+    ConcurrentNode *found = find_in_bucket(markov_chain, head, NULL, data_ptr,
+                                           hash);
+    if (found) {
+        return found;
+    }
+    ConcurrentNode *new_node = calloc(1, sizeof(ConcurrentNode));
+    if (!new_node) {
+        return NULL;
+    }
+    new_node->data = markov_chain->copy_func(data_ptr);
+    if (!new_node->data) {
+        free(new_node);
+        return NULL;
+    }
+    new_node->hash = hash;
+    new_node->has_dot = markov_chain->is_last(new_node->data);
+    while (true) {
+        new_node->next_in_bucket = head;
+        // on failure head is set to the current head of the bucket
+        if (__atomic_compare_exchange_n(bucket, &head, new_node, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+            __atomic_fetch_add(&markov_chain->states_count, 1,
+                               __ATOMIC_RELAXED);
+            return new_node;
+        }
+        // only the states added since the last search may be data_ptr
+        found = find_in_bucket(markov_chain, head, new_node->next_in_bucket,
+                               data_ptr, hash);
+        if (found) {
+            markov_chain->free_data(new_node->data);
+            free(new_node);
+            return found;
+        }
+    }
+}
+
+
+/**
+ * Increment the counter of second_node in the counters of first_node.
+ * @return true if the counter was found, false if second_node is not a
+ * successor of first_node yet.
+ */
+static bool increment_counter(ConcurrentNode *first_node,
+                              ConcurrentNode *second_node) {
+    int count = LOAD_ACQUIRE(&first_node->counter_lst_size);
+    for (CounterChunk *chunk = LOAD_ACQUIRE(&first_node->first_chunk);
+         chunk != NULL && count > 0; chunk = LOAD_ACQUIRE(&chunk->next)) {
+        for (int i = 0; i < chunk->capacity && count > 0; i++, count--) {
+            if (chunk->counters[i].node == second_node) {
+                __atomic_fetch_add(&chunk->counters[i].frequency, 1,
+                                   __ATOMIC_RELAXED);
+                // after the counter, so a reader of freq_sum sees it counted
+                __atomic_fetch_add(&first_node->freq_sum, 1,
+                                   __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Add second_node as a new successor of first_node. Called under the stripe
+ * lock of first_node.
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+static bool append_counter(ConcurrentNode *first_node,
+                           ConcurrentNode *second_node) {
+    CounterChunk *chunk = first_node->last_chunk;
+    if (!chunk || chunk->size == chunk->capacity) {
+        int capacity = chunk ? 2 * chunk->capacity : FIRST_CHUNK_CAPACITY;
+        CounterChunk *new_chunk = calloc(1, sizeof(CounterChunk) +
+                                            capacity *
+                                            sizeof(ConcurrentCounter));
+        if (!new_chunk) {
+            return false;
+        }
+        new_chunk->capacity = capacity;
+        STORE_RELEASE(chunk ? &chunk->next : &first_node->first_chunk,
+                      new_chunk);
+        first_node->last_chunk = new_chunk;
+        chunk = new_chunk;
+    }
+    chunk->counters[chunk->size++] = (ConcurrentCounter) {second_node, 1};
+    STORE_RELEASE(&first_node->counter_lst_size,
+                  first_node->counter_lst_size + 1);
+    __atomic_fetch_add(&first_node->freq_sum, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+/**
+ * Count one more occurrence of second_node after first_node. Safe to call from
+ * any thread.
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_concurrent_pair(ConcurrentMarkovChain *markov_chain,
+                         ConcurrentNode *first_node,
+                         ConcurrentNode *second_node) {
+    if (increment_counter(first_node, second_node)) {
+        return true;
+    }
+    pthread_mutex_t *lock = &markov_chain->locks[
+            (first_node->hash ^ first_node->hash >> 32) % LOCK_STRIPES];
+    pthread_mutex_lock(lock);
+    // another thread may have added it before the lock was taken
+    bool success = increment_counter(first_node, second_node) ||
+                   append_counter(first_node, second_node);
+    pthread_mutex_unlock(lock);
+    return success;
+}
+
+
+/**
+ * Choose randomly the next state, depend on it's occurrence frequency, while
+ * other threads may be training the chain.
+ * @param node ConcurrentNode to choose from
+ * @param seed random state of the calling thread
+ * @return the chosen state, NULL if node has no successors
+ */
+ConcurrentNode *get_next_concurrent_node(ConcurrentNode *node,
+                                         unsigned int *seed) {
+    // freq_sum is read first: the counters it includes are all published, so
+    // their frequencies sum to at least it.
+    int freq_sum = LOAD_ACQUIRE(&node->freq_sum);
+    if (freq_sum == 0) {
+        return NULL;
+    }
+    int i = get_random_number_r(seed, freq_sum);
+    int count = LOAD_ACQUIRE(&node->counter_lst_size);
+    ConcurrentNode *chosen = NULL;
+    for (CounterChunk *chunk = LOAD_ACQUIRE(&node->first_chunk);
+         chunk != NULL && count > 0; chunk = LOAD_ACQUIRE(&chunk->next)) {
+        for (int j = 0; j < chunk->capacity && count > 0; j++, count--) {
+            chosen = chunk->counters[j].node;
+            i -= __atomic_load_n(&chunk->counters[j].frequency,
+                                 __ATOMIC_RELAXED);
+            if (i < 0) {
+                return chosen;
+            }
+        }
+    }
+    return chosen;
+}
+
+
+/**
+ * Generate a random sequence into sequence, while other threads may be
+ * training the chain.
+ * @param first_node state to start with
+ * @param max_length maximum length of sequence to generate
+ * @param sequence array of at least max_length states to fill
+ * @param seed random state of the calling thread
+ * @return length of the generated sequence
+ */
+int generate_concurrent_sequence(ConcurrentNode *first_node, int max_length,
+                                 ConcurrentNode **sequence,
+                                 unsigned int *seed) {
+    int length = 0;
+    ConcurrentNode *current_node = first_node;
+    while (current_node != NULL && length < max_length) {
+        sequence[length++] = current_node;
+        if (current_node->has_dot) {
+            break;
+        }
+        current_node = get_next_concurrent_node(current_node, seed);
+    }
+    return length;
+}
@@ -0,0 +1,125 @@
+#ifndef _CONCURRENT_CHAIN_H
+#define _CONCURRENT_CHAIN_H
+
+#include "markov_chain.h"
+#include <stdint.h> // For uint64_t
+#include <pthread.h>
+
+#define LOCK_STRIPES 64
+
+typedef struct ConcurrentCounter {
+    struct ConcurrentNode *node;
+    int frequency; // updated atomically
+} ConcurrentCounter;
+
+/**
+ * Counters of a state are stored in chunks that never move, so a counter can
+ * be incremented atomically while other counters are added.
+ */
+typedef struct CounterChunk {
+    struct CounterChunk *next; // published atomically
+    int capacity;
+    int size; // only used under the stripe lock
+    ConcurrentCounter counters[];
+} CounterChunk;
+
+typedef struct ConcurrentNode {
+    void *data;
+    uint64_t hash;
+    int has_dot;
+    struct ConcurrentNode *next_in_bucket; // set once, before it is published
+    CounterChunk *first_chunk;             // published atomically
+    CounterChunk *last_chunk;              // only used under the stripe lock
+    int counter_lst_size;                  // published atomically
+    int freq_sum;                          // updated atomically
+} ConcurrentNode;
+
+/**
+ * A markov chain that many threads can train and generate from at once.
+ * States are found in a hash table whose buckets are lock-free lists. The
+ * frequencies of existing successors are incremented atomically, and new
+ * successors are added under one of LOCK_STRIPES locks, chosen by the state.
+ * Nothing is removed or moved until the chain is freed, so readers never see
+ * freed memory, and a reader sees every successor counted in freq_sum.
+ */
+typedef struct ConcurrentMarkovChain {
+    ConcurrentNode **buckets; // heads are published atomically
+    int buckets_count;        // a power of 2
+    int states_count;         // updated atomically
+    pthread_mutex_t locks[LOCK_STRIPES];
+
+    // same functions as in MarkovChain
+    int (*comp_func) (void *, void *);
+    void (*free_data) (void *);
+    void *(*copy_func) (void *);
+    bool (*is_last) (void *);
+
+    // pointer to a func that gets a pointer of generic data type and returns
+    // it's hash. Equal data must have equal hashes.
+    uint64_t (*hash_func) (void *);
+} ConcurrentMarkovChain;
+
+/**
+ * Create an empty concurrent chain. The functions of the data are set by the
+ * caller before the chain is used.
+ * @param buckets_count minimal number of buckets of the states hash table
+ * @return newly allocated chain, NULL in case of allocation failure
+ */
+ConcurrentMarkovChain *create_concurrent_chain(int buckets_count);
+
+/**
+ * Free markov_chain and all of it's content from memory. No other thread may
+ * use the chain meanwhile.
+ * @param markov_chain chain to free
+ */
+void free_concurrent_chain(ConcurrentMarkovChain **markov_chain);
+
+/**
+ * Find the state of data_ptr in the chain. Safe to call from any thread.
+ * @return the state, NULL if data_ptr is not in the chain
+ */
+ConcurrentNode *get_concurrent_node(ConcurrentMarkovChain *markov_chain,
+                                    void *data_ptr);
+
+/**
+ * Find the state of data_ptr, or add a new one for it. Safe to call from any
+ * thread; if two threads add the same data, both get the same state.
+ * @return the state, NULL in case of allocation failure
+ */
+ConcurrentNode *add_concurrent_node(ConcurrentMarkovChain *markov_chain,
+                                    void *data_ptr);
+
+/**
+ * Count one more occurrence of second_node after first_node. Safe to call from
+ * any thread.
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_concurrent_pair(ConcurrentMarkovChain *markov_chain,
+                         ConcurrentNode *first_node,
+                         ConcurrentNode *second_node);
+
+/**
+ * Choose randomly the next state, depend on it's occurrence frequency, while
+ * other threads may be training the chain.
+ * @param node ConcurrentNode to choose from
+ * @param seed random state of the calling thread
+ * @return the chosen state, NULL if node has no successors
+ */
+ConcurrentNode *get_next_concurrent_node(ConcurrentNode *node,
+                                         unsigned int *seed);
+
+/**
+ * Generate a random sequence into sequence, while other threads may be
+ * training the chain.
+ * @param first_node state to start with
+ * @param max_length maximum length of sequence to generate
+ * @param sequence array of at least max_length states to fill
+ * @param seed random state of the calling thread
+ * @return length of the generated sequence
+ */
+int generate_concurrent_sequence(ConcurrentNode *first_node, int max_length,
+                                 ConcurrentNode **sequence,
+                                 unsigned int *seed);
+
+#endif /* _CONCURRENT_CHAIN_H */
@@ -0,0 +1,340 @@
+#include "constrained_generation.h"
+
+
+/**
+ * Build the reverse edges of the given markov_chain.
+ * @param markov_chain trained chain
+ * @return newly allocated ReverseIndex, NULL in case of allocation failure
+ */
+ReverseIndex *create_reverse_index(MarkovChain *markov_chain) {
+    if (!markov_chain) {
+        return NULL;
+    }
+    ReverseIndex *reverse_index = calloc(1, sizeof(ReverseIndex));
+    if (!reverse_index) {
+        return NULL;
+    }
+    int nodes_count = markov_chain->database->size;
+    reverse_index->nodes_count = nodes_count;
+    reverse_index->nodes = malloc(sizeof(MarkovNode *) * (nodes_count + 1));
+    reverse_index->offsets = calloc(nodes_count + 1, sizeof(int));
+    if (!reverse_index->nodes || !reverse_index->offsets) {
+        free_reverse_index(&reverse_index);
+        return NULL;
+    }
+
+    // count the predecessors of every node:
+    int edges_count = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        MarkovNode *markov_node = node->data;
+        reverse_index->nodes[markov_node->index] = markov_node;
+        for (int j = 0; j < markov_node->counter_lst_size; j++) {
+            reverse_index->offsets[
+                    markov_node->counter_list[j].markov_node->index + 1]++;
+            edges_count++;
+        }
+    }
+    for (int i = 0; i < nodes_count; i++) {
+        reverse_index->offsets[i + 1] += reverse_index->offsets[i];
+    }
+
+    reverse_index->predecessors = malloc(sizeof(MarkovNode *) *
+                                         (edges_count + 1));
+    int *fill = malloc(sizeof(int) * (nodes_count + 1));
+    if (!reverse_index->predecessors || !fill) {
+        free(fill);
+        free_reverse_index(&reverse_index);
+        return NULL;
+    }
+    for (int i = 0; i < nodes_count; i++) {
+        fill[i] = reverse_index->offsets[i];
+    }
+    for (int i = 0; i < nodes_count; i++) {
+        MarkovNode *markov_node = reverse_index->nodes[i];
+        for (int j = 0; j < markov_node->counter_lst_size; j++) {
+            int to = markov_node->counter_list[j].markov_node->index;
+            reverse_index->predecessors[fill[to]++] = markov_node;
+        }
+    }
+    free(fill);
+    return reverse_index;
+}
+
+
+/**
+ * Free reverse_index and all of it's content from memory.
+ * @param reverse_index reverse index to free
+ */
+void free_reverse_index(ReverseIndex **ptr_reverse_index) {
+    ReverseIndex *reverse_index = *ptr_reverse_index;
+    if (!reverse_index) {
+        return;
+    }
+    free(reverse_index->nodes);
+    free(reverse_index->offsets);
+    free(reverse_index->predecessors);
+    free(reverse_index);
+    *ptr_reverse_index = NULL;
+}
+
+
+/**
+ * Sort the nodes that may start a sequence by their distance to the target
+ * (counting sort), so the starts that fit any length budget are a prefix.
+ * @param reachability reachability with computed distances
+ * @return true on success, false in case of allocation failure
+ */
+static bool sort_starts(Reachability *reachability) {
+    int nodes_count = reachability->reverse_index->nodes_count;
+    int buckets = reachability->max_distance + 1;
+    reachability->starts = malloc(sizeof(int) * (nodes_count + 1));
+    reachability->starts_within = calloc(buckets, sizeof(int));
+    if (!reachability->starts || !reachability->starts_within) {
+        return false;
+    }
+    for (int i = 0; i < nodes_count; i++) {
+        if (reachability->distance[i] > 0) {
+            reachability->starts_within[reachability->distance[i]]++;
+        }
+    }
+    for (int d = 1; d < buckets; d++) {
+        reachability->starts_within[d] += reachability->starts_within[d - 1];
+    }
+    int starts_count = reachability->starts_within[buckets - 1];
+    // starts with distance d end right before starts_within[d]:
+    for (int i = nodes_count - 1; i >= 0; i--) {
+        int distance = reachability->distance[i];
+        if (distance > 0) {
+            reachability->starts[--reachability->starts_within[distance]] = i;
+        }
+    }
+    // every starts_within[d] moved back to the count of distances < d:
+    for (int d = 0; d < buckets - 1; d++) {
+        reachability->starts_within[d] = reachability->starts_within[d + 1];
+    }
+    reachability->starts_within[buckets - 1] = starts_count;
+    return true;
+}
+
+
+/**
+ * Compute, for every state of the chain, the minimal number of steps needed
+ * to reach target (breadth first search over the reverse edges).
+ * @param reverse_index reverse edges of the chain target belongs to
+ * @param target the state every generated sequence should reach
+ * @return newly allocated Reachability, NULL in case of allocation failure
+ */
+Reachability *create_reachability(ReverseIndex *reverse_index,
+                                  MarkovNode *target) {
+    if (!reverse_index || !target) {
+        return NULL;
+    }
+    Reachability *reachability = calloc(1, sizeof(Reachability));
+    if (!reachability) {
+        return NULL;
+    }
+    int nodes_count = reverse_index->nodes_count;
+    reachability->reverse_index = reverse_index;
+    reachability->target = target;
+    reachability->distance = malloc(sizeof(int) * (nodes_count + 1));
+    int *queue = malloc(sizeof(int) * (nodes_count + 1));
+    if (!reachability->distance || !queue) {
+        free(queue);
+        free_reachability(&reachability);
+        return NULL;
+    }
+    for (int i = 0; i < nodes_count; i++) {
+        reachability->distance[i] = NO_PATH;
+    }
+
+    int head = 0, tail = 0;
+    reachability->distance[target->index] = 0;
+    queue[tail++] = target->index;
+    while (head < tail) {
+        int current = queue[head++];
+        for (int j = reverse_index->offsets[current];
+             j < reverse_index->offsets[current + 1]; j++) {
+            MarkovNode *predecessor = reverse_index->predecessors[j];
+            // generation stops at a last state, so no path goes through one
+            if (predecessor->has_dot ||
+                reachability->distance[predecessor->index] != NO_PATH) {
+                continue;
+            }
+            reachability->distance[predecessor->index] =
+                    reachability->distance[current] + 1;
+            queue[tail++] = predecessor->index;
+        }
+    }
+    reachability->max_distance = reachability->distance[queue[tail - 1]];
+    free(queue);
+
+    if (!sort_starts(reachability)) {
+        free_reachability(&reachability);
+        return NULL;
+    }
+    return reachability;
+}
+
+
+/**
+ * Free reachability and all of it's content from memory. The reverse index it
+ * was created from is not freed.
+ * @param reachability reachability to free
+ */
+void free_reachability(Reachability **ptr_reachability) {
+    Reachability *reachability = *ptr_reachability;
+    if (!reachability) {
+        return;
+    }
+    free(reachability->distance);
+    free(reachability->starts);
+    free(reachability->starts_within);
+    free(reachability);
+    *ptr_reachability = NULL;
+}
+
+
+/**
+ * Choose randomly the next state out of the ones that can reach the target in
+ * at most budget steps, depend on their occurrence frequency.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param reachability precomputed distances to the target
+ * @param budget maximal distance of the chosen state from the target
+ * @return MarkovNode of the chosen state, NULL if there is none
+ */
+static MarkovNode *get_next_productive_node(MarkovNode *state_struct_ptr,
+                                            Reachability *reachability,
+                                            int budget) {
+    NextNodeCounter *counter_list = state_struct_ptr->counter_list;
+    int freq_sum = 0;
+    for (int j = 0; j < state_struct_ptr->counter_lst_size; j++) {
+        int distance = reachability->distance[counter_list[j].markov_node
+                ->index];
+        if (distance != NO_PATH && distance <= budget) {
+            freq_sum += counter_list[j].frequency;
+        }
+    }
+    if (freq_sum == 0) {
+        return NULL;
+    }
+    if (state_struct_ptr->counter_lst_size == 1) {
+        return counter_list[0].markov_node; // no choice, nothing to draw
+    }
+    int i = get_random_number(freq_sum);
+    for (int j = 0; j < state_struct_ptr->counter_lst_size; j++) {
+        int distance = reachability->distance[counter_list[j].markov_node
+                ->index];
+        if (distance == NO_PATH || distance > budget) {
+            continue;
+        }
+        if (counter_list[j].frequency <= i) {
+            i -= counter_list[j].frequency;
+        } else {
+            return counter_list[j].markov_node;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Check whether any sentence of at most max_length words (and at least 2) can
+ * reach the target of reachability.
+ * @param reachability precomputed distances to the target
+ * @param max_length maximum length of chain to generate
+ * @return true if such a sentence exists, false otherwise
+ */
+bool can_reach_target(Reachability *reachability, int max_length) {
+    if (!reachability || max_length < 2) {
+        return false;
+    }
+    int max_start_distance = max_length - 1;
+    if (max_start_distance > reachability->max_distance) {
+        max_start_distance = reachability->max_distance;
+    }
+    return reachability->starts_within[max_start_distance] > 0;
+}
+
+
+/**
+ * Check whether a sentence of at most max_length words (and at least 2) that
+ * starts with first_node can reach the target of reachability.
+ * @param reachability precomputed distances to the target
+ * @param first_node first markov_node of the sentence
+ * @param max_length maximum length of chain to generate
+ * @return true if such a sentence exists, false otherwise
+ */
+bool can_reach_target_from(Reachability *reachability, MarkovNode *first_node,
+                           int max_length) {
+    if (!reachability || !first_node || max_length < 2) {
+        return false;
+    }
+    // the first node must not be the target, so there are at least 2 words
+    int distance = reachability->distance[first_node->index];
+    return distance >= 1 && distance <= max_length - 1;
+}
+
+
+/**
+ * Generate and print a random sentence that contains (or ends with) the
+ * target of reachability. Only successors that can still reach the target
+ * within the remaining length are sampled, so a single pass is enough. The
+ * sentence has at least 2 words in it.
+ * @param markov_chain
+ * @param reachability precomputed distances to the target
+ * @param first_node markov_node to start with, if NULL- choose a random
+ *                   markov_node that can reach the target in time
+ * @param max_length maximum length of chain to generate
+ * @param mode whether the sentence should contain or end with the target
+ * @return true if a sentence was generated, false if no sentence of at most
+ * max_length words can reach the target.
+ */
+bool generate_constrained_sequence(MarkovChain *markov_chain,
+                                   Reachability *reachability,
+                                   MarkovNode *first_node, int max_length,
+                                   ConstraintMode mode) {
+    if (!markov_chain || !reachability || max_length < 2) {
+        return false;
+    }
+    // the first node must not be the target, so there are at least 2 words
+    int max_start_distance = max_length - 1;
+    if (max_start_distance > reachability->max_distance) {
+        max_start_distance = reachability->max_distance;
+    }
+    if (!first_node) {
+        int starts_count = reachability->starts_within[max_start_distance];
+        if (starts_count == 0) {
+            return false;
+        }
+        first_node = reachability->reverse_index->nodes[
+                reachability->starts[get_random_number(starts_count)]];
+    }
+    if (!can_reach_target_from(reachability, first_node, max_length)) {
+        return false;
+    }
+
+    int length = 0;
+    bool reached = false;
+    MarkovNode *current_node = first_node;
+    while (current_node != NULL && length < max_length) {
+        markov_chain->print_func(current_node->data);
+        length++;
+        if (current_node == reachability->target) {
+            reached = true;
+            if (mode == CONSTRAINT_END_WITH) {
+                break;
+            }
+        }
+        if (markov_chain->is_last(current_node->data)) {
+            break;
+        }
+        if (reached) {
+            current_node = get_next_random_node(current_node);
+        } else {
+            current_node = get_next_productive_node(current_node, reachability,
+                                                    max_length - length - 1);
+        }
+    }
+    return true;
+}
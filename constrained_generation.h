@@ -0,0 +1,109 @@
+#ifndef _CONSTRAINED_GENERATION_H
+#define _CONSTRAINED_GENERATION_H
+
+#include "markov_chain.h"
+
+#define NO_PATH -1
+
+typedef enum ConstraintMode {
+    CONSTRAINT_CONTAIN,  // the sequence must pass through the target state
+    CONSTRAINT_END_WITH  // the sequence must stop at the target state
+} ConstraintMode;
+
+/**
+ * Reverse edges of a trained markov_chain, stored as one contiguous array.
+ * The predecessors of the node with index i are
+ * predecessors[offsets[i]] ... predecessors[offsets[i + 1] - 1].
+ * The index has to be rebuilt if the chain is changed after it was created.
+ */
+typedef struct ReverseIndex {
+    MarkovNode **nodes; // nodes of the chain by their index
+    int nodes_count;
+    int *offsets;
+    MarkovNode **predecessors;
+} ReverseIndex;
+
+/**
+ * For a single target state, the minimal number of steps every state needs
+ * to reach it. Paths never go through a last state, since generation stops
+ * there.
+ */
+typedef struct Reachability {
+    ReverseIndex *reverse_index;
+    MarkovNode *target;
+    int *distance;     // distance[i] is NO_PATH if node i can't reach target
+    int *starts;       // indices of possible first nodes, sorted by distance
+    int *starts_within;// starts_within[d] = number of starts with distance<=d
+    int max_distance;
+} Reachability;
+
+/**
+ * Build the reverse edges of the given markov_chain.
+ * @param markov_chain trained chain
+ * @return newly allocated ReverseIndex, NULL in case of allocation failure
+ */
+ReverseIndex *create_reverse_index(MarkovChain *markov_chain);
+
+/**
+ * Free reverse_index and all of it's content from memory.
+ * @param reverse_index reverse index to free
+ */
+void free_reverse_index(ReverseIndex **reverse_index);
+
+/**
+ * Compute, for every state of the chain, the minimal number of steps needed
+ * to reach target.
+ * @param reverse_index reverse edges of the chain target belongs to
+ * @param target the state every generated sequence should reach
+ * @return newly allocated Reachability, NULL in case of allocation failure
+ */
+Reachability *create_reachability(ReverseIndex *reverse_index,
+                                  MarkovNode *target);
+
+/**
+ * Free reachability and all of it's content from memory. The reverse index it
+ * was created from is not freed.
+ * @param reachability reachability to free
+ */
+void free_reachability(Reachability **reachability);
+
+/**
+ * Check whether any sentence of at most max_length words (and at least 2) can
+ * reach the target of reachability.
+ * @param reachability precomputed distances to the target
+ * @param max_length maximum length of chain to generate
+ * @return true if such a sentence exists, false otherwise
+ */
+bool can_reach_target(Reachability *reachability, int max_length);
+
+/**
+ * Check whether a sentence of at most max_length words (and at least 2) that
+ * starts with first_node can reach the target of reachability.
+ * @param reachability precomputed distances to the target
+ * @param first_node first markov_node of the sentence
+ * @param max_length maximum length of chain to generate
+ * @return true if such a sentence exists, false otherwise
+ */
+bool can_reach_target_from(Reachability *reachability, MarkovNode *first_node,
+                           int max_length);
+
+/**
+ * Generate and print a random sentence that contains (or ends with) the
+ * target of reachability. Only successors that can still reach the target
+ * within the remaining length are sampled, so a single pass is enough. The
+ * sentence has at least 2 words in it.
+ * @param markov_chain
+ * @param reachability precomputed distances to the target
+ * @param first_node markov_node to start with, if NULL- choose a random
+ *                   markov_node that can reach the target in time
+ * @param max_length maximum length of chain to generate
+ * @param mode whether the sentence should contain or end with the target
+ * @return true if a sentence was generated, false if no sentence of at most
+ * max_length words can reach the target.
+ */
+bool generate_constrained_sequence(MarkovChain *markov_chain,
+                                   Reachability *reachability,
+                                   MarkovNode *first_node, int max_length,
+                                   ConstraintMode mode);
+
+#endif /* _CONSTRAINED_GENERATION_H */
@@ -0,0 +1,293 @@
+#include "copy_filter.h"
+#include <math.h> // For log(), exp(), pow()
+
+#define BITS_PER_WORD 64
+#define MAX_BLOOM_HASHES 16 // more memory only lowers the false positive rate
+#define SEQUENCE_HASH_BASE 0x100000001B3ULL
+
+
+/**
+ * splitmix64 finalizer, so the bits of similar hashes differ.
+ */
+static uint64_t mix_hash(uint64_t hash) {
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+
+/**
+ * Create an empty bloom filter for expected_items items. It's size is memory
+ * if given, or the size that gives false_positive_rate otherwise; the number
+ * of hashes is the best one for that size, bounded so a check stays cheap.
+ * @param expected_items number of items that will be added
+ * @param false_positive_rate wanted rate, in (0, 1), used if memory is 0
+ * @param memory size of the bits in bytes, 0 to size by false_positive_rate
+ * @return newly allocated filter, NULL in case of allocation failure or bad
+ * parameters
+ */
+BloomFilter *create_bloom_filter(long expected_items,
+                                 double false_positive_rate, size_t memory) {
+    if (memory == 0 && (false_positive_rate <= 0 || false_positive_rate >= 1)) {
+        return NULL;
+    }
+    double items = expected_items > 0 ? (double) expected_items : 1;
+    double bits = memory > 0 ? 8.0 * memory :
+                  -items * log(false_positive_rate) / (log(2) * log(2));
+    size_t words = (size_t) ceil(bits / BITS_PER_WORD);
+    BloomFilter *filter = malloc(sizeof(BloomFilter));
+    if (!filter) {
+        return NULL;
+    }
+    filter->bits = calloc(words > 0 ? words : 1, sizeof(uint64_t));
+    if (!filter->bits) {
+        free(filter);
+        return NULL;
+    }
+    filter->bits_count = (words > 0 ? words : 1) * BITS_PER_WORD;
+    filter->hashes_count = (int) round(filter->bits_count / items * log(2));
+    if (filter->hashes_count < 1) {
+        filter->hashes_count = 1;
+    } else if (filter->hashes_count > MAX_BLOOM_HASHES) {
+        filter->hashes_count = MAX_BLOOM_HASHES;
+    }
+    filter->items_count = 0;
+    return filter;
+}
+
+
+/**
+ * Free filter and all of it's content from memory.
+ * @param filter filter to free
+ */
+void free_bloom_filter(BloomFilter **ptr_filter) {
+    BloomFilter *filter = *ptr_filter;
+    if (!filter) {
+        return;
+    }
+    free(filter->bits);
+    free(filter);
+    *ptr_filter = NULL;
+}
+
+
+/**
+ * Add an item to filter. The bits are chosen by double hashing: the i-th one
+ * is first + i * second.
+ * @param filter
+ * @param hash hash of the item
+ */
+void add_to_bloom_filter(BloomFilter *filter, uint64_t hash) {
+    uint64_t first = mix_hash(hash), second = mix_hash(first) | 1;
+    for (int i = 0; i < filter->hashes_count; i++) {
+        size_t bit = (size_t) ((first + i * second) % filter->bits_count);
+        filter->bits[bit / BITS_PER_WORD] |= 1ULL << (bit % BITS_PER_WORD);
+    }
+    filter->items_count++;
+}
+
+
+/**
+ * Check whether an item may be in filter.
+ * @param filter
+ * @param hash hash of the item
+ * @return false if the item was not added, true if it was (or on a false
+ * positive)
+ */
+bool bloom_filter_contains(const BloomFilter *filter, uint64_t hash) {
+    uint64_t first = mix_hash(hash), second = mix_hash(first) | 1;
+    for (int i = 0; i < filter->hashes_count; i++) {
+        size_t bit = (size_t) ((first + i * second) % filter->bits_count);
+        if (!(filter->bits[bit / BITS_PER_WORD] &
+              (1ULL << (bit % BITS_PER_WORD)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Estimated false positive rate of filter with the items added so far:
+ * (1 - e^(-k * n / m))^k.
+ * @param filter
+ * @return rate in [0, 1]
+ */
+double bloom_filter_error_rate(const BloomFilter *filter) {
+    double set_fraction = 1 - exp(-(double) filter->hashes_count *
+                                  filter->items_count / filter->bits_count);
+    return pow(set_fraction, filter->hashes_count);
+}
+
+
+/**
+ * Create an empty copy filter.
+ * @param lines_count number of training lines that will be added
+ * @param words_count number of training words that will be added
+ * @param ngram_length number of words in the checked n-grams, 0 to check only
+ *                     whole lines, MIN_NGRAM_LENGTH to MAX_NGRAM_LENGTH
+ *                     otherwise
+ * @param false_positive_rate wanted rate of every bloom filter, used if
+ *                            memory is 0
+ * @param memory size of all the bloom filters in bytes, 0 to size them by
+ *               false_positive_rate
+ * @return newly allocated filter, NULL in case of allocation failure or bad
+ * parameters
+ */
+CopyFilter *create_copy_filter(long lines_count, long words_count,
+                               int ngram_length, double false_positive_rate,
+                               size_t memory) {
+    if (ngram_length != 0 && (ngram_length < MIN_NGRAM_LENGTH ||
+                              ngram_length > MAX_NGRAM_LENGTH)) {
+        return NULL;
+    }
+    CopyFilter *filter = calloc(1, sizeof(CopyFilter));
+    if (!filter) {
+        return NULL;
+    }
+    // a given memory is shared by the filters by their number of items
+    size_t lines_memory = memory, ngrams_memory = 0;
+    if (memory > 0 && ngram_length > 0) {
+        lines_memory = (size_t) ((double) memory * lines_count /
+                                 ((double) lines_count + words_count + 1)) + 1;
+        ngrams_memory = memory > lines_memory ? memory - lines_memory : 1;
+    }
+    filter->lines = create_bloom_filter(lines_count, false_positive_rate,
+                                        lines_memory);
+    if (filter->lines && ngram_length > 0) {
+        filter->ngrams = create_bloom_filter(words_count, false_positive_rate,
+                                             ngrams_memory);
+    }
+    if (!filter->lines || (ngram_length > 0 && !filter->ngrams)) {
+        free_copy_filter(&filter);
+        return NULL;
+    }
+    filter->ngram_length = ngram_length;
+    filter->base_power = 1;
+    for (int i = 1; i < ngram_length; i++) {
+        filter->base_power *= SEQUENCE_HASH_BASE;
+    }
+    return filter;
+}
+
+
+/**
+ * Free filter and all of it's content from memory.
+ * @param filter filter to free
+ */
+void free_copy_filter(CopyFilter **ptr_filter) {
+    CopyFilter *filter = *ptr_filter;
+    if (!filter) {
+        return;
+    }
+    free_bloom_filter(&filter->lines);
+    free_bloom_filter(&filter->ngrams);
+    free(filter);
+    *ptr_filter = NULL;
+}
+
+
+/**
+ * Size of the bloom filters of filter.
+ * @param filter
+ * @return size in bytes
+ */
+size_t copy_filter_memory(const CopyFilter *filter) {
+    size_t memory = filter->lines->bits_count / 8;
+    if (filter->ngrams) {
+        memory += filter->ngrams->bits_count / 8;
+    }
+    return memory;
+}
+
+
+/**
+ * Start hashing a new sequence.
+ * @param hasher hasher to reset
+ */
+void start_sequence_hash(SequenceHasher *hasher) {
+    hasher->line_hash = 0;
+    hasher->ngram_hash = 0;
+    hasher->length = 0;
+}
+
+
+/**
+ * Add the next word to the hashes of hasher. Both are polynomial hashes of
+ * the word hashes, so the n-gram hash rolls: the word that leaves the window
+ * is subtracted.
+ * @return true if the window holds ngram_length words
+ */
+static bool push_word(const CopyFilter *filter, SequenceHasher *hasher,
+                      uint64_t word_hash) {
+    word_hash = mix_hash(word_hash);
+    hasher->line_hash = hasher->line_hash * SEQUENCE_HASH_BASE + word_hash;
+    hasher->length++;
+    int length = filter->ngram_length;
+    if (length == 0) {
+        return false;
+    }
+    uint64_t *slot = &hasher->window[(hasher->length - 1) % length];
+    if (hasher->length > length) {
+        hasher->ngram_hash -= *slot * filter->base_power;
+    }
+    hasher->ngram_hash = hasher->ngram_hash * SEQUENCE_HASH_BASE + word_hash;
+    *slot = word_hash;
+    return hasher->length >= length;
+}
+
+
+/**
+ * Add the next word of a training line to the hashes of hasher, and it's
+ * n-gram to filter.
+ * @param filter
+ * @param hasher hashes of the line so far
+ * @param word_hash hash (or id) of the word
+ */
+void add_training_word(CopyFilter *filter, SequenceHasher *hasher,
+                       uint64_t word_hash) {
+    if (push_word(filter, hasher, word_hash)) {
+        add_to_bloom_filter(filter->ngrams, hasher->ngram_hash);
+    }
+}
+
+
+/**
+ * Add the training line hashed by hasher to filter. Empty lines are ignored.
+ * @param filter
+ * @param hasher hashes of the whole line
+ */
+void add_training_line(CopyFilter *filter, const SequenceHasher *hasher) {
+    if (hasher->length > 0) {
+        add_to_bloom_filter(filter->lines,
+                            hasher->line_hash ^ (uint64_t) hasher->length);
+    }
+}
+
+
+/**
+ * Add the next word of a generated sequence to the hashes of hasher, and
+ * check the n-gram it ends. O(1) per word.
+ * @param filter
+ * @param hasher hashes of the sequence so far
+ * @param word_hash hash (or id) of the word
+ * @return true if the n-gram that ends with this word is in a training line
+ */
+bool is_copied_word(const CopyFilter *filter, SequenceHasher *hasher,
+                    uint64_t word_hash) {
+    return push_word(filter, hasher, word_hash) &&
+           bloom_filter_contains(filter->ngrams, hasher->ngram_hash);
+}
+
+
+/**
+ * Check whether the sequence hashed by hasher is a whole training line.
+ * @param filter
+ * @param hasher hashes of the whole sequence
+ * @return true if it is a training line
+ */
+bool is_copied_line(const CopyFilter *filter, const SequenceHasher *hasher) {
+    return hasher->length > 0 &&
+           bloom_filter_contains(filter->lines,
+                                 hasher->line_hash ^ (uint64_t) hasher->length);
+}
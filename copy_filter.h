@@ -0,0 +1,160 @@
+#ifndef _COPY_FILTER_H
+#define _COPY_FILTER_H
+
+#include <stdlib.h>
+#include <stdbool.h> // for bool
+#include <stdint.h> // For uint64_t
+
+#define MIN_NGRAM_LENGTH 3 // every 2 consecutive words of a generated sequence
+                           // are a pair of the chain, so they were trained on
+#define MAX_NGRAM_LENGTH 32
+
+/**
+ * Bloom filter: every item sets hashes_count bits, chosen by it's hash. An item
+ * that was added is always found, one that wasn't is found with a small
+ * probability (a false positive).
+ */
+typedef struct BloomFilter {
+    uint64_t *bits;
+    size_t bits_count;
+    int hashes_count;
+    long items_count;
+} BloomFilter;
+
+/**
+ * Filter of sequences that copy the training lines: hashes of the whole lines,
+ * and optionally of every ngram_length consecutive words in them.
+ */
+typedef struct CopyFilter {
+    BloomFilter *lines;
+    BloomFilter *ngrams; // NULL if only whole lines are checked
+    int ngram_length;
+    uint64_t base_power; // SEQUENCE_HASH_BASE to the power ngram_length - 1
+} CopyFilter;
+
+/**
+ * Hashes of a sequence that is fed one word at a time.
+ */
+typedef struct SequenceHasher {
+    uint64_t line_hash;                // of all the words so far
+    uint64_t ngram_hash;               // of the last ngram_length words
+    uint64_t window[MAX_NGRAM_LENGTH]; // hashes of the last words, cyclic
+    int length;
+} SequenceHasher;
+
+/**
+ * Create an empty bloom filter for expected_items items. It's size is memory
+ * if given, or the size that gives false_positive_rate otherwise; the number
+ * of hashes is the best one for that size, bounded so a check stays cheap.
+ * @param expected_items number of items that will be added
+ * @param false_positive_rate wanted rate, in (0, 1), used if memory is 0
+ * @param memory size of the bits in bytes, 0 to size by false_positive_rate
+ * @return newly allocated filter, NULL in case of allocation failure or bad
+ * parameters
+ */
+BloomFilter *create_bloom_filter(long expected_items,
+                                 double false_positive_rate, size_t memory);
+
+/**
+ * Free filter and all of it's content from memory.
+ * @param filter filter to free
+ */
+void free_bloom_filter(BloomFilter **filter);
+
+/**
+ * Add an item to filter.
+ * @param filter
+ * @param hash hash of the item
+ */
+void add_to_bloom_filter(BloomFilter *filter, uint64_t hash);
+
+/**
+ * Check whether an item may be in filter.
+ * @param filter
+ * @param hash hash of the item
+ * @return false if the item was not added, true if it was (or on a false
+ * positive)
+ */
+bool bloom_filter_contains(const BloomFilter *filter, uint64_t hash);
+
+/**
+ * Estimated false positive rate of filter with the items added so far.
+ * @param filter
+ * @return rate in [0, 1]
+ */
+double bloom_filter_error_rate(const BloomFilter *filter);
+
+/**
+ * Create an empty copy filter.
+ * @param lines_count number of training lines that will be added
+ * @param words_count number of training words that will be added
+ * @param ngram_length number of words in the checked n-grams, 0 to check only
+ *                     whole lines, MIN_NGRAM_LENGTH to MAX_NGRAM_LENGTH
+ *                     otherwise
+ * @param false_positive_rate wanted rate of every bloom filter, used if
+ *                            memory is 0
+ * @param memory size of all the bloom filters in bytes, 0 to size them by
+ *               false_positive_rate
+ * @return newly allocated filter, NULL in case of allocation failure or bad
+ * parameters
+ */
+CopyFilter *create_copy_filter(long lines_count, long words_count,
+                               int ngram_length, double false_positive_rate,
+                               size_t memory);
+
+/**
+ * Free filter and all of it's content from memory.
+ * @param filter filter to free
+ */
+void free_copy_filter(CopyFilter **filter);
+
+/**
+ * Size of the bloom filters of filter.
+ * @param filter
+ * @return size in bytes
+ */
+size_t copy_filter_memory(const CopyFilter *filter);
+
+/**
+ * Start hashing a new sequence.
+ * @param hasher hasher to reset
+ */
+void start_sequence_hash(SequenceHasher *hasher);
+
+/**
+ * Add the next word of a training line to the hashes of hasher, and it's
+ * n-gram to filter.
+ * @param filter
+ * @param hasher hashes of the line so far
+ * @param word_hash hash (or id) of the word
+ */
+void add_training_word(CopyFilter *filter, SequenceHasher *hasher,
+                       uint64_t word_hash);
+
+/**
+ * Add the training line hashed by hasher to filter. Empty lines are ignored.
+ * @param filter
+ * @param hasher hashes of the whole line
+ */
+void add_training_line(CopyFilter *filter, const SequenceHasher *hasher);
+
+/**
+ * Add the next word of a generated sequence to the hashes of hasher, and
+ * check the n-gram it ends. O(1) per word.
+ * @param filter
+ * @param hasher hashes of the sequence so far
+ * @param word_hash hash (or id) of the word
+ * @return true if the n-gram that ends with this word is in a training line
+ */
+bool is_copied_word(const CopyFilter *filter, SequenceHasher *hasher,
+                    uint64_t word_hash);
+
+/**
+ * Check whether the sequence hashed by hasher is a whole training line.
+ * @param filter
+ * @param hasher hashes of the whole sequence
+ * @return true if it is a training line
+ */
+bool is_copied_line(const CopyFilter *filter, const SequenceHasher *hasher);
+
+#endif /* _COPY_FILTER_H */
@@ -0,0 +1,316 @@
+#include "external_training.h"
+#include <string.h>
+
+#define LINE_LENGTH 1001
+#define WORD_DELIMITERS " \n\r"
+
+/**
+ * An occurrence of state, followed by successor. successor is NULL for the
+ * last word of a sequence, so states with no successors are saved too.
+ */
+typedef struct PairEntry {
+    const char *state;
+    const char *successor;
+} PairEntry;
+
+/**
+ * Buffer of memory_budget bytes: the words are copied from it's start and the
+ * pairs are added from it's end, until they meet.
+ */
+typedef struct RunBuffer {
+    char *memory;
+    size_t size;
+    size_t words_end;   // first free byte for words
+    size_t pairs_count; // pairs are at the end of memory, in reverse order
+    FILE *runs[MERGE_FAN_IN]; // open runs, oldest (and biggest) first
+    int levels[MERGE_FAN_IN]; // times the pairs of every run were merged
+    int runs_count;
+    int spilled_count;
+    int merges_count;
+} RunBuffer;
+
+
+static PairEntry *buffer_pairs(RunBuffer *buffer) {
+    return (PairEntry *) (buffer->memory + buffer->size) -
+           buffer->pairs_count;
+}
+
+
+static size_t buffer_free_bytes(RunBuffer *buffer) {
+    return buffer->size - buffer->words_end -
+           buffer->pairs_count * sizeof(PairEntry);
+}
+
+
+/**
+ * Copy word to the words of buffer, which must have room for it.
+ * @return the copy of word
+ */
+static char *buffer_add_word(RunBuffer *buffer, const char *word) {
+    size_t length = strlen(word) + 1;
+    char *copy = buffer->memory + buffer->words_end;
+    memcpy(copy, word, length);
+    buffer->words_end += length;
+    return copy;
+}
+
+
+static int compare_pairs(const void *first, const void *second) {
+    const PairEntry *first_pair = first;
+    const PairEntry *second_pair = second;
+    int result = strcmp(first_pair->state, second_pair->state);
+    if (result != 0) {
+        return result;
+    }
+    if (!first_pair->successor || !second_pair->successor) {
+        return (first_pair->successor != NULL) -
+               (second_pair->successor != NULL);
+    }
+    return strcmp(first_pair->successor, second_pair->successor);
+}
+
+
+/**
+ * Write the pairs of buffer to file as a saved model: sort them, and count the
+ * occurrences of every (state, successor).
+ */
+static void write_run(PairEntry *pairs, size_t pairs_count, FILE *file) {
+    qsort(pairs, pairs_count, sizeof(PairEntry), compare_pairs);
+    fprintf(file, "%s\n", MODEL_HEADER);
+    for (size_t i = 0; i < pairs_count;) {
+        const char *state = pairs[i].state;
+        fprintf(file, "S %s\n", state);
+        while (i < pairs_count && !pairs[i].successor &&
+               strcmp(pairs[i].state, state) == 0) {
+            i++;
+        }
+        while (i < pairs_count && strcmp(pairs[i].state, state) == 0) {
+            size_t j = i + 1;
+            while (j < pairs_count &&
+                   strcmp(pairs[j].state, state) == 0 &&
+                   strcmp(pairs[j].successor, pairs[i].successor) == 0) {
+                j++;
+            }
+            fprintf(file, "E %s %ld\n", pairs[i].successor, (long) (j - i));
+            i = j;
+        }
+    }
+}
+
+
+/**
+ * Merge the newest runs of buffer into one, so no more than MERGE_FAN_IN runs
+ * are ever open. Runs are merged by level, as a cascade: the newest runs of
+ * the lowest level (with the runs of the level above if it has a single one)
+ * become one run of the next level, so a pair is merged about
+ * log(runs) times.
+ * @return true on success, false in case of file error
+ */
+static bool cascade_runs(RunBuffer *buffer) {
+    int last = buffer->runs_count - 1;
+    int first = last;
+    while (first > 0 && buffer->levels[first - 1] == buffer->levels[last]) {
+        first--;
+    }
+    if (first == last && first > 0) {
+        first--;
+        while (first > 0 &&
+               buffer->levels[first - 1] == buffer->levels[last - 1]) {
+            first--;
+        }
+    }
+    FILE *merged = tmpfile();
+    if (!merged) {
+        return false;
+    }
+    for (int i = first; i <= last; i++) {
+        rewind(buffer->runs[i]);
+    }
+    if (!merge_models(buffer->runs + first, last - first + 1, merged)) {
+        fclose(merged);
+        return false;
+    }
+    for (int i = first; i <= last; i++) {
+        fclose(buffer->runs[i]);
+    }
+    // levels only decrease along the runs, so the first is the highest
+    buffer->levels[first]++;
+    buffer->runs[first] = merged;
+    buffer->runs_count = first + 1;
+    buffer->merges_count++;
+    return true;
+}
+
+
+/**
+ * Spill the pairs of buffer to a new temporary run and empty the buffer.
+ * @return true on success, false in case of allocation or file error
+ */
+static bool spill_run(RunBuffer *buffer) {
+    if (buffer->pairs_count == 0) {
+        return true;
+    }
+    if (buffer->runs_count == MERGE_FAN_IN && !cascade_runs(buffer)) {
+        return false;
+    }
+    FILE *run = tmpfile();
+    if (!run) {
+        return false;
+    }
+    buffer->levels[buffer->runs_count] = 0;
+    buffer->runs[buffer->runs_count++] = run;
+    buffer->spilled_count++;
+    write_run(buffer_pairs(buffer), buffer->pairs_count, run);
+    buffer->words_end = 0;
+    buffer->pairs_count = 0;
+    return !ferror(run);
+}
+
+
+/**
+ * Add a pair to buffer, spilling it first if it is full.
+ * @param buffer
+ * @param prev previous word of the sequence (in the line), NULL if none
+ * @param prev_copy copy of prev in buffer, updated if buffer is spilled
+ * @param word the current word (in the line), NULL to end a sequence
+ * @param word_copy set to the copy of word in buffer
+ * @return true on success, false in case of allocation or file error
+ */
+static bool buffer_add_pair(RunBuffer *buffer, const char *prev,
+                            const char **prev_copy, const char *word,
+                            const char **word_copy) {
+    size_t needed = (word ? strlen(word) + 1 : 0) +
+                    (prev ? sizeof(PairEntry) : 0);
+    if (buffer_free_bytes(buffer) < needed) {
+        if (!spill_run(buffer)) {
+            return false;
+        }
+        // an empty buffer has room for two words of a line and their pair
+        if (prev) {
+            *prev_copy = buffer_add_word(buffer, prev);
+        }
+    }
+    const char *copy = word ? buffer_add_word(buffer, word) : NULL;
+    if (prev) {
+        buffer->pairs_count++;
+        *buffer_pairs(buffer) = (PairEntry) {*prev_copy, copy};
+    }
+    if (word_copy) {
+        *word_copy = copy;
+    }
+    return true;
+}
+
+
+/**
+ * Merge the runs of buffer, at most MERGE_FAN_IN, into output.
+ * @return true on success, false in case of allocation or file error
+ */
+static bool merge_runs(RunBuffer *buffer, FILE *output) {
+    for (int i = 0; i < buffer->runs_count; i++) {
+        rewind(buffer->runs[i]);
+    }
+    buffer->merges_count++;
+    return merge_models(buffer->runs, buffer->runs_count, output);
+}
+
+
+/**
+ * Split the next word of a line off it. Unlike strtok, keeps no state of it's
+ * own, so merging runs (which reads them with strtok) in the middle of a line
+ * doesn't lose the rest of it.
+ * @param cursor the rest of the line, set to after the word
+ * @return the word, NULL if there are no more words
+ */
+static char *next_word(char **cursor) {
+    char *word = *cursor + strspn(*cursor, WORD_DELIMITERS);
+    if (*word == '\0') {
+        return NULL;
+    }
+    char *end = word + strcspn(word, WORD_DELIMITERS);
+    *cursor = *end == '\0' ? end : end + 1;
+    *end = '\0';
+    return word;
+}
+
+
+/**
+ * Read the corpus into sorted runs.
+ * @return true on success, false in case of allocation or file error
+ */
+static bool create_runs(FILE *corpus, long words_to_read, RunBuffer *buffer,
+                        TrainingStats *stats) {
+    char line[LINE_LENGTH];
+    long counter = 0;
+    while (counter != words_to_read && fgets(line, LINE_LENGTH, corpus)) {
+        const char *prev = NULL, *prev_copy = NULL;
+        char *cursor = line;
+        for (char *word = next_word(&cursor);
+             word != NULL && counter != words_to_read;
+             word = next_word(&cursor)) {
+            const char *word_copy;
+            if (!buffer_add_pair(buffer, prev, &prev_copy, word, &word_copy)) {
+                return false;
+            }
+            prev = word;
+            prev_copy = word_copy;
+            counter++;
+        }
+        // the last word of the sequence is a state even with no successor
+        if (prev && !buffer_add_pair(buffer, prev, &prev_copy, NULL, NULL)) {
+            return false;
+        }
+    }
+    if (stats) {
+        stats->words_count = counter;
+    }
+    return !ferror(corpus) && spill_run(buffer);
+}
+
+
+/**
+ * Train a model of words on a text corpus without keeping the chain in
+ * memory. Every line is a sequence of words separated by whitespace. The
+ * (state, successor) pairs are collected in a buffer of memory_budget bytes;
+ * whenever it is full they are sorted, counted and spilled to a temporary
+ * file as a sorted run. At most MERGE_FAN_IN runs are kept open: once there
+ * are that many, the newest ones are merged into one run (a cascade merge),
+ * so any size of corpus can be trained. The runs left are merged into the
+ * output model, in the format of save_markov_chain.
+ * @param corpus text file opened for reading
+ * @param words_to_read number of words to read, -1 to read the whole file
+ * @param memory_budget size of the pairs buffer in bytes, at least
+ *                      MIN_MEMORY_BUDGET
+ * @param output file opened for writing
+ * @param stats filled with statistics of the training, may be NULL
+ * @return true on success, false in case of allocation or file error
+ */
+bool train_external(FILE *corpus, long words_to_read, size_t memory_budget,
+                    FILE *output, TrainingStats *stats) {
+    if (!corpus || !output || memory_budget < MIN_MEMORY_BUDGET) {
+        return false;
+    }
+    if (stats) {
+        *stats = (TrainingStats) {0, 0, 0};
+    }
+    RunBuffer buffer = {0};
+    buffer.size = memory_budget - memory_budget % sizeof(void *);
+    buffer.memory = malloc(buffer.size);
+    if (!buffer.memory) {
+        return false;
+    }
+    bool success = create_runs(corpus, words_to_read, &buffer, stats);
+    free(buffer.memory); // the merge needs no more than the readers
+    buffer.memory = NULL;
+    if (success) {
+        success = merge_runs(&buffer, output);
+    }
+    if (stats) {
+        stats->runs_count = buffer.spilled_count;
+        stats->merges_count = buffer.merges_count;
+    }
+    for (int i = 0; i < buffer.runs_count; i++) {
+        fclose(buffer.runs[i]);
+    }
+    return success && !ferror(output);
+}
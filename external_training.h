@@ -0,0 +1,35 @@
+#ifndef _EXTERNAL_TRAINING_H
+#define _EXTERNAL_TRAINING_H
+
+#include "markov_io.h"
+
+#define MIN_MEMORY_BUDGET (64 * 1024)
+#define MERGE_FAN_IN 32
+
+typedef struct TrainingStats {
+    long words_count;
+    int runs_count;   // sorted runs spilled
+    int merges_count; // merges of runs, the final one into the model included
+} TrainingStats;
+
+/**
+ * Train a model of words on a text corpus without keeping the chain in
+ * memory. Every line is a sequence of words separated by whitespace. The
+ * (state, successor) pairs are collected in a buffer of memory_budget bytes;
+ * whenever it is full they are sorted, counted and spilled to a temporary
+ * file as a sorted run. At most MERGE_FAN_IN runs are kept open: once there
+ * are that many, the newest ones are merged into one run (a cascade merge),
+ * so any size of corpus can be trained. The runs left are merged into the
+ * output model, in the format of save_markov_chain.
+ * @param corpus text file opened for reading
+ * @param words_to_read number of words to read, -1 to read the whole file
+ * @param memory_budget size of the pairs buffer in bytes, at least
+ *                      MIN_MEMORY_BUDGET
+ * @param output file opened for writing
+ * @param stats filled with statistics of the training, may be NULL
+ * @return true on success, false in case of allocation or file error
+ */
+bool train_external(FILE *corpus, long words_to_read, size_t memory_budget,
+                    FILE *output, TrainingStats *stats);
+
+#endif /* _EXTERNAL_TRAINING_H */
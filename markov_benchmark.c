@@ -0,0 +1,1015 @@
+#define _POSIX_C_SOURCE 199309L // For clock_gettime()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h> // For LONG_MAX
+#include "markov_chain.h"
+#include "concurrent_chain.h"
+#include "markov_io.h"
+#include "vocabulary.h"
+#include "copy_filter.h"
+#include "external_training.h"
+#include "sketch_training.h"
+#include <math.h>
+
+#define USAGE_MSG "Usage: markov_benchmark <benchmark> <text corpus> [count]\n\
+benchmarks: sampling (count: sampled steps)\n\
+            external (count: copies of the corpus to train on)\n\
+            pruning\n\
+            concurrent (count: copies of the corpus to train on)\n\
+            vocabulary (count: copies in the synthetic corpus)\n\
+            streaming (count: generated states)\n\
+            successors (count: sampled steps)\n\
+            copies (count: checked sequences)\n"
+#define FILE_PATH_ERROR "Error: Cannot open file, check file path.\n"
+#define LINE_LENGTH 1001
+#define DECIMAL_BASE 10
+#define SEED 42
+#define DEFAULT_ITERATIONS 2000000
+#define DEFAULT_CORPUS_COPIES 20
+#define KIB 1024
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define MODEL_WEIGHT 0.95 // of the model in the perplexity, vs uniform
+#define SEQUENCE_MAX_LENGTH 20
+#define DEFAULT_TRAINING_COPIES 4
+#define MAX_THREADS 64
+#define GENERATED_STEPS 4000000
+#define DEFAULT_SYNTHETIC_COPIES 100
+#define MAX_IN_FLIGHT 10000
+#define SYNTHETIC_NEW_WORDS 4 // one word of 4 is new in every synthetic copy
+#define DEFAULT_COPY_CHECKS 1000000
+#define COPY_NGRAM_LENGTH 4
+#define CHECKED_SEQUENCE_LENGTH 12
+
+/*
+ * Word callbacks of a chain that keeps every word as it's own string, as
+ * tweets_generator did before it interned the words in a vocabulary (see
+ * benchmark_vocabulary for what that saves). The chain benchmarks only need
+ * words, so they keep these simpler callbacks.
+ */
+static int compare_words(void *data_1, void *data_2) {
+    return strcmp((const char *) data_1, (const char *) data_2);
+}
+
+static void print_nothing(void *data) {
+    (void) data;
+}
+
+static void *copy_word(void *data) {
+    const char *word = (const char *) data;
+    char *new_allocated_word = calloc(sizeof(char), strlen(word) + 1);
+    if (new_allocated_word) {
+        strcpy(new_allocated_word, word);
+    }
+    return new_allocated_word;
+}
+
+static const char *word_token(void *data) {
+    return data;
+}
+
+static bool is_last_word(void *data) {
+    const char *word = (const char *) data;
+    return word[strlen(word) - 1] == '.';
+}
+
+static double seconds_since(clock_t start) {
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* clock() sums the time of all the threads, so threads are timed by this */
+static double wall_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Create an empty chain of words.
+ * @return newly allocated chain, NULL in case of allocation failure
+ */
+static MarkovChain *create_word_chain(void) {
+    MarkovChain *markov_chain = malloc(sizeof(MarkovChain));
+    LinkedList *database = calloc(1, sizeof(LinkedList));
+    if (!markov_chain || !database) {
+        free(markov_chain);
+        free(database);
+        return NULL;
+    }
+    markov_chain->database = database;
+    markov_chain->comp_func = &compare_words;
+    markov_chain->print_func = &print_nothing;
+    markov_chain->copy_func = &copy_word;
+    markov_chain->free_data = &free;
+    markov_chain->is_last = &is_last_word;
+    return markov_chain;
+}
+
+static uint64_t hash_word(void *data) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const char *c = data; *c; c++) {
+        hash = (hash ^ (unsigned char) *c) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * Key of a pair of words in the sketch, from the hashes of both words. The
+ * sketch mixes the key itself.
+ */
+static uint64_t hash_words(const char *first_word, const char *second_word) {
+    return hash_word((void *) first_word) * FNV_PRIME ^
+           hash_word((void *) second_word);
+}
+
+/**
+ * Train markov_chain on every line of the file.
+ * @param sketch if not NULL, pairs enter the chain only once they were seen
+ *               min_count times, as tweets_generator --sketch-memory does
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int train_word_chain(FILE *fp, MarkovChain *markov_chain,
+                            CountMinSketch *sketch, int min_count) {
+    char line[LINE_LENGTH];
+    while (fgets(line, LINE_LENGTH, fp)) {
+        Node *prev = NULL;
+        char *prev_word = NULL;
+        for (char *word = strtok(line, " \n\r"); word != NULL;
+             word = strtok(NULL, " \n\r")) {
+            if (sketch) {
+                if (prev_word && !add_pair_with_sketch(
+                        markov_chain, sketch, min_count, prev_word, word,
+                        hash_words(prev_word, word))) {
+                    return EXIT_FAILURE;
+                }
+                prev_word = word;
+                continue;
+            }
+            Node *current = add_to_database(markov_chain, word);
+            if (!current) {
+                return EXIT_FAILURE;
+            }
+            if (prev && !add_node_to_counter_list(prev->data, current->data,
+                                                  markov_chain)) {
+                return EXIT_FAILURE;
+            }
+            prev = current;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Walk the chain for the given number of steps with the given sampling
+ * controls, restarting from a random node whenever a sentence ends.
+ * @return sampled steps per second
+ */
+static double walk_steps(MarkovNode **nodes, int nodes_count,
+                         const GenerationParams *params, long steps) {
+    clock_t start = clock();
+    MarkovNode *current = nodes[get_random_number(nodes_count)];
+    for (long i = 0; i < steps; i++) {
+        current = get_next_sampled_node(current, params);
+        if (!current || current->has_dot) {
+            current = nodes[get_random_number(nodes_count)];
+        }
+    }
+    return steps / seconds_since(start);
+}
+
+/**
+ * Throughput of get_next_sampled_node with the different sampling controls.
+ */
+static int benchmark_sampling(MarkovChain *markov_chain, long iterations) {
+    int nodes_count = 0;
+    MarkovNode **nodes = malloc(sizeof(MarkovNode *) *
+                                markov_chain->database->size);
+    if (!nodes) {
+        return EXIT_FAILURE;
+    }
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        if (!node->data->has_dot && node->data->counter_lst_size > 0) {
+            nodes[nodes_count++] = node->data;
+        }
+    }
+    struct {
+        const char *name;
+        GenerationParams params;
+    } modes[] = {
+            {"frequency",        {SEQUENCE_MAX_LENGTH, 0,  1.0, 1.0}},
+            {"top-k 5",          {SEQUENCE_MAX_LENGTH, 5,  1.0, 1.0}},
+            {"top-p 0.9",        {SEQUENCE_MAX_LENGTH, 0,  0.9, 1.0}},
+            {"temperature 0.7",  {SEQUENCE_MAX_LENGTH, 0,  1.0, 0.7}},
+            {"top-k 20, t 1.5",  {SEQUENCE_MAX_LENGTH, 20, 1.0, 1.5}},
+            {"greedy",           {SEQUENCE_MAX_LENGTH, 0,  1.0, 0.0}},
+    };
+    printf("%-18s %14s\n", "mode", "steps/sec");
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        printf("%-18s %14.0f\n", modes[i].name,
+               walk_steps(nodes, nodes_count, &modes[i].params, iterations));
+    }
+    free(nodes);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Throughput of train_external on copies of the corpus, with different memory
+ * budgets.
+ */
+static int benchmark_external(FILE *file, long copies) {
+    FILE *corpus = tmpfile();
+    if (!corpus) {
+        return EXIT_FAILURE;
+    }
+    char line[LINE_LENGTH];
+    for (long i = 0; i < copies; i++) {
+        rewind(file);
+        while (fgets(line, LINE_LENGTH, file)) {
+            fputs(line, corpus);
+        }
+    }
+    size_t budgets[] = {64 * KIB, 256 * KIB, KIB * KIB, 4 * KIB * KIB,
+                        16 * KIB * KIB, 64 * KIB * KIB};
+    printf("%ld copies of the corpus, %ld bytes\n", copies, ftell(corpus));
+    printf("%12s %14s %8s %8s %10s\n", "budget (KiB)", "words/sec", "runs",
+           "merges", "seconds");
+    int result = EXIT_SUCCESS;
+    for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+        FILE *output = tmpfile();
+        TrainingStats stats;
+        rewind(corpus);
+        clock_t start = clock();
+        if (!output || !train_external(corpus, -1, budgets[i], output,
+                                       &stats)) {
+            result = EXIT_FAILURE;
+        }
+        double seconds = seconds_since(start);
+        if (output) {
+            fclose(output);
+        }
+        if (result == EXIT_FAILURE) {
+            break;
+        }
+        printf("%12lu %14.0f %8d %8d %10.2f\n",
+               (unsigned long) (budgets[i] / KIB), stats.words_count / seconds,
+               stats.runs_count, stats.merges_count, seconds);
+    }
+    fclose(corpus);
+    return result;
+}
+
+static int compare_node_words(const void *first, const void *second) {
+    return strcmp((*(MarkovNode *const *) first)->data,
+                  (*(MarkovNode *const *) second)->data);
+}
+
+static int compare_word_to_node(const void *word, const void *node) {
+    return strcmp(word, (*(MarkovNode *const *) node)->data);
+}
+
+/**
+ * Perplexity of the chain on the pairs of the corpus. The probability of a
+ * pair is mixed with a uniform one over vocabulary_size words, so pairs that
+ * are not in the chain are not impossible.
+ */
+static double corpus_perplexity(FILE *fp, MarkovChain *markov_chain,
+                                int vocabulary_size) {
+    int nodes_count = markov_chain->database->size;
+    MarkovNode **nodes = malloc(sizeof(MarkovNode *) * (nodes_count + 1));
+    if (!nodes) {
+        return -1;
+    }
+    int i = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        nodes[i++] = node->data;
+    }
+    qsort(nodes, nodes_count, sizeof(MarkovNode *), compare_node_words);
+
+    char line[LINE_LENGTH];
+    double log_sum = 0;
+    long pairs = 0;
+    rewind(fp);
+    while (fgets(line, LINE_LENGTH, fp)) {
+        MarkovNode **prev = NULL;
+        bool has_prev = false;
+        for (char *word = strtok(line, " \n\r"); word != NULL;
+             word = strtok(NULL, " \n\r")) {
+            MarkovNode **current = bsearch(word, nodes, nodes_count,
+                                           sizeof(MarkovNode *),
+                                           compare_word_to_node);
+            if (has_prev) {
+                double probability = 0;
+                for (int j = 0; prev && current &&
+                                j < (*prev)->counter_lst_size; j++) {
+                    if ((*prev)->counter_list[j].markov_node == *current) {
+                        probability = (double) (*prev)->counter_list[j]
+                                .frequency / (*prev)->freq_sum;
+                    }
+                }
+                log_sum += log(MODEL_WEIGHT * probability +
+                               (1 - MODEL_WEIGHT) / vocabulary_size);
+                pairs++;
+            }
+            prev = current;
+            has_prev = true;
+        }
+    }
+    free(nodes);
+    return exp(-log_sum / pairs);
+}
+
+/**
+ * Approximate memory of the chain: the list nodes, the states with their
+ * words and the counter lists that are not inline.
+ */
+static size_t chain_memory(MarkovChain *markov_chain, long *edges_count) {
+    size_t memory = 0;
+    *edges_count = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        memory += sizeof(Node) + sizeof(MarkovNode) +
+                  strlen(node->data->data) + 1;
+        if (node->data->counter_lst_size > INLINE_COUNTERS) {
+            memory += sizeof(NextNodeCounter) * node->data->counter_lst_size;
+        }
+        *edges_count += node->data->counter_lst_size;
+    }
+    return memory;
+}
+
+/**
+ * Memory saved against perplexity lost by pruning and by training with a
+ * count-min sketch.
+ */
+static int benchmark_pruning(FILE *file) {
+    struct {
+        const char *name;
+        size_t sketch_memory;
+        int min_count;
+        int prune_frequency;
+    } configs[] = {
+            {"exact",                 0,         0, 0},
+            {"prune 2",               0,         0, 2},
+            {"prune 3",               0,         0, 3},
+            {"prune 5",               0,         0, 5},
+            {"sketch 16K, count 2",   16 * KIB,  2, 0},
+            {"sketch 64K, count 2",   64 * KIB,  2, 0},
+            {"sketch 256K, count 2",  256 * KIB, 2, 0},
+            {"sketch 256K, count 3",  256 * KIB, 3, 0},
+    };
+    int vocabulary_size = 0;
+    printf("perplexity on the corpus pairs, mixed %.2f with uniform\n",
+           MODEL_WEIGHT);
+    printf("%-22s %8s %8s %12s %8s %11s\n", "config", "states", "edges",
+           "memory (KiB)", "saved", "perplexity");
+    size_t exact_memory = 0;
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        MarkovChain *markov_chain = create_word_chain();
+        CountMinSketch *sketch = NULL;
+        if (configs[i].sketch_memory > 0) {
+            sketch = create_count_min_sketch(configs[i].sketch_memory);
+        }
+        rewind(file);
+        if (!markov_chain || (configs[i].sketch_memory > 0 && !sketch) ||
+            train_word_chain(file, markov_chain, sketch,
+                             configs[i].min_count) ||
+            (configs[i].prune_frequency > 0 &&
+             !prune_markov_chain(markov_chain, configs[i].prune_frequency))) {
+            free_count_min_sketch(&sketch);
+            if (markov_chain) {
+                free_markov_chain(&markov_chain);
+            }
+            return EXIT_FAILURE;
+        }
+        free_count_min_sketch(&sketch);
+        long edges_count;
+        size_t memory = chain_memory(markov_chain, &edges_count);
+        if (i == 0) {
+            exact_memory = memory;
+            vocabulary_size = markov_chain->database->size;
+        }
+        printf("%-22s %8d %8ld %12.0f %7.0f%% %11.1f\n", configs[i].name,
+               markov_chain->database->size, edges_count,
+               (double) memory / KIB,
+               100.0 * (1 - (double) memory / exact_memory),
+               corpus_perplexity(file, markov_chain, vocabulary_size));
+        free_markov_chain(&markov_chain);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * The corpus split to words in memory: the words of every line are followed
+ * by NULL in words, and lines holds the index of the first word of every line.
+ */
+typedef struct WordCorpus {
+    char *text;
+    char **words;
+    long *lines;
+    long lines_count;
+    long pairs_count;
+} WordCorpus;
+
+/**
+ * A thread of the concurrent benchmark. A writer trains the chain on the lines
+ * index, index + stride, ... of the corpus. A reader generates sequences from
+ * the first words of random lines until it made steps_limit steps, or until
+ * no writers are left if writers_left is not NULL.
+ */
+typedef struct ConcurrentTask {
+    ConcurrentMarkovChain *markov_chain;
+    const WordCorpus *corpus;
+    bool is_writer;
+    long index;
+    long stride;
+    long steps_limit;
+    int *writers_left;
+    unsigned int seed;
+    long steps; // pairs added by a writer, states generated by a reader
+    bool failed;
+} ConcurrentTask;
+
+static void free_word_corpus(WordCorpus *corpus) {
+    free(corpus->text);
+    free(corpus->words);
+    free(corpus->lines);
+}
+
+/**
+ * Read the file to corpus, with it's lines repeated copies times.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int read_word_corpus(FILE *file, long copies, WordCorpus *corpus) {
+    *corpus = (WordCorpus) {NULL, NULL, NULL, 0, 0};
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    corpus->text = malloc(size + 1);
+    // a word is at least one character and a delimiter
+    corpus->words = malloc(sizeof(char *) * (size + 1));
+    if (!corpus->text || !corpus->words ||
+        fread(corpus->text, 1, size, file) != (size_t) size) {
+        free_word_corpus(corpus);
+        return EXIT_FAILURE;
+    }
+    corpus->text[size] = '\0';
+    long lines_bound = 1;
+    for (char *c = strchr(corpus->text, '\n'); c; c = strchr(c + 1, '\n')) {
+        lines_bound++;
+    }
+    corpus->lines = malloc(sizeof(long) * lines_bound * copies);
+    if (!corpus->lines) {
+        free_word_corpus(corpus);
+        return EXIT_FAILURE;
+    }
+    long words_count = 0, lines_count = 0, pairs_count = 0;
+    for (char *line = corpus->text; line != NULL && *line != '\0';) {
+        char *line_end = strchr(line, '\n');
+        if (line_end) {
+            *line_end = '\0';
+        }
+        long first_word = words_count;
+        for (char *word = strtok(line, " \r"); word != NULL;
+             word = strtok(NULL, " \r")) {
+            corpus->words[words_count++] = word;
+        }
+        if (words_count > first_word) {
+            pairs_count += words_count - first_word - 1;
+            corpus->words[words_count++] = NULL;
+            corpus->lines[lines_count++] = first_word;
+        }
+        line = line_end ? line_end + 1 : NULL;
+    }
+    for (long i = lines_count; i < lines_count * copies; i++) {
+        corpus->lines[i] = corpus->lines[i % lines_count];
+    }
+    corpus->lines_count = lines_count * copies;
+    corpus->pairs_count = pairs_count * copies;
+    return EXIT_SUCCESS;
+}
+
+static void *run_concurrent_task(void *arg) {
+    ConcurrentTask *task = arg;
+    const WordCorpus *corpus = task->corpus;
+    if (task->is_writer) {
+        for (long i = task->index; i < corpus->lines_count; i += task->stride) {
+            ConcurrentNode *prev = NULL;
+            for (char **word = corpus->words + corpus->lines[i]; *word;
+                 word++) {
+                ConcurrentNode *current = add_concurrent_node(
+                        task->markov_chain, *word);
+                if (!current || (prev && !add_concurrent_pair(
+                        task->markov_chain, prev, current))) {
+                    task->failed = true;
+                    break;
+                }
+                task->steps += prev != NULL;
+                prev = current;
+            }
+        }
+        if (task->writers_left) {
+            __atomic_fetch_sub(task->writers_left, 1, __ATOMIC_RELEASE);
+        }
+        return NULL;
+    }
+    ConcurrentNode *sequence[SEQUENCE_MAX_LENGTH];
+    while (task->steps < task->steps_limit &&
+           (!task->writers_left ||
+            __atomic_load_n(task->writers_left, __ATOMIC_ACQUIRE) > 0)) {
+        long line = get_random_number_r(&task->seed, corpus->lines_count);
+        ConcurrentNode *first_node = get_concurrent_node(
+                task->markov_chain, corpus->words[corpus->lines[line]]);
+        if (first_node) { // the line may not be trained on yet
+            task->steps += generate_concurrent_sequence(
+                    first_node, SEQUENCE_MAX_LENGTH, sequence, &task->seed);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Run the tasks on threads of their own.
+ * @return wall time in seconds, -1 if a task failed
+ */
+static double run_concurrent_tasks(ConcurrentTask *tasks, int tasks_count) {
+    pthread_t threads[2 * MAX_THREADS];
+    double start = wall_seconds();
+    for (int i = 0; i < tasks_count; i++) {
+        if (pthread_create(&threads[i], NULL, run_concurrent_task,
+                           &tasks[i]) != 0) {
+            tasks_count = i;
+            tasks[i].failed = true;
+        }
+    }
+    bool failed = false;
+    for (int i = 0; i < tasks_count; i++) {
+        pthread_join(threads[i], NULL);
+        failed = failed || tasks[i].failed;
+    }
+    double seconds = wall_seconds() - start;
+    return failed ? -1 : seconds;
+}
+
+static ConcurrentMarkovChain *create_concurrent_word_chain(void) {
+    ConcurrentMarkovChain *markov_chain = create_concurrent_chain(1 << 16);
+    if (markov_chain) {
+        markov_chain->comp_func = &compare_words;
+        markov_chain->copy_func = &copy_word;
+        markov_chain->free_data = &free;
+        markov_chain->is_last = &is_last_word;
+        markov_chain->hash_func = &hash_word;
+    }
+    return markov_chain;
+}
+
+/**
+ * Sum of the frequencies of all the pairs in the chain, to check no update
+ * was lost.
+ */
+static long concurrent_chain_pairs(ConcurrentMarkovChain *markov_chain) {
+    long pairs = 0;
+    for (int i = 0; i < markov_chain->buckets_count; i++) {
+        for (ConcurrentNode *node = markov_chain->buckets[i]; node != NULL;
+             node = node->next_in_bucket) {
+            pairs += node->freq_sum;
+        }
+    }
+    return pairs;
+}
+
+/**
+ * Throughput of the concurrent chain with 1 to MAX_THREADS threads: training
+ * alone, generating alone, and writers training while as many readers
+ * generate.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int benchmark_concurrent(FILE *file, long copies) {
+    WordCorpus corpus;
+    if (read_word_corpus(file, copies, &corpus)) {
+        return EXIT_FAILURE;
+    }
+    printf("%ld copies of the corpus, %ld pairs\n", copies,
+           corpus.pairs_count);
+    printf("%7s %14s %14s %14s %14s %6s\n", "threads", "train pairs/s",
+           "gen steps/s", "mixed pairs/s", "mixed steps/s", "check");
+    ConcurrentTask tasks[2 * MAX_THREADS];
+    int result = EXIT_SUCCESS;
+    for (int threads = 1; threads <= MAX_THREADS && result == EXIT_SUCCESS;
+         threads *= 2) {
+        double rates[4] = {0};
+        bool counted = true;
+        for (int mixed = 0; mixed <= 1; mixed++) {
+            ConcurrentMarkovChain *markov_chain =
+                    create_concurrent_word_chain();
+            if (!markov_chain) {
+                result = EXIT_FAILURE;
+                break;
+            }
+            int writers_left = threads;
+            for (int i = 0; i < 2 * threads; i++) {
+                tasks[i] = (ConcurrentTask) {
+                        markov_chain, &corpus, i < threads, i, threads,
+                        mixed ? LONG_MAX : GENERATED_STEPS / threads,
+                        mixed ? &writers_left : NULL, SEED + i, 0, false};
+            }
+            // without mixing, the readers start once the writers are done
+            double seconds = run_concurrent_tasks(tasks, mixed ? 2 * threads
+                                                               : threads);
+            double read_seconds = mixed ? seconds : run_concurrent_tasks(
+                    tasks + threads, threads);
+            long pairs = 0, steps = 0;
+            for (int i = 0; i < threads; i++) {
+                pairs += tasks[i].steps;
+                steps += tasks[threads + i].steps;
+            }
+            counted = counted && pairs == corpus.pairs_count &&
+                      concurrent_chain_pairs(markov_chain) == pairs;
+            free_concurrent_chain(&markov_chain);
+            if (seconds < 0 || read_seconds < 0) {
+                result = EXIT_FAILURE;
+                break;
+            }
+            rates[2 * mixed] = pairs / seconds;
+            rates[2 * mixed + 1] = steps / read_seconds;
+        }
+        if (result == EXIT_SUCCESS) {
+            printf("%7d %14.0f %14.0f %14.0f %14.0f %6s\n", threads, rates[0],
+                   rates[1], rates[2], rates[3], counted ? "ok" : "lost");
+        }
+    }
+    free_word_corpus(&corpus);
+    return result;
+}
+
+/* Bytes glibc takes for a malloc of size bytes on 64 bit: the size with an
+ * 8 bytes header, rounded up to 16, and at least 32. */
+static size_t allocation_size(size_t size) {
+    size_t chunk = (size + 8 + 15) & ~(size_t) 15;
+    return chunk < 32 ? 32 : chunk;
+}
+
+/**
+ * Intern the words of the file copies times. In every copy but the first, one
+ * word of SYNTHETIC_NEW_WORDS is made a new word by a suffix, so the
+ * vocabulary grows with the copies.
+ * @param strings_memory set to the memory of the distinct words as separate
+ *                       allocations, the way copy_word keeps them
+ * @return number of words, -1 in case of allocation failure
+ */
+static long intern_corpus(FILE *file, long copies, Vocabulary *vocabulary,
+                          size_t *strings_memory) {
+    char line[LINE_LENGTH];
+    char word_buffer[LINE_LENGTH + 32];
+    long words_count = 0;
+    *strings_memory = 0;
+    for (long copy = 0; copy < copies; copy++) {
+        rewind(file);
+        while (fgets(line, LINE_LENGTH, file)) {
+            for (char *word = strtok(line, " \n\r"); word != NULL;
+                 word = strtok(NULL, " \n\r")) {
+                if (copy > 0 && rand() % SYNTHETIC_NEW_WORDS == 0) {
+                    sprintf(word_buffer, "%s~%ld", word, copy);
+                    word = word_buffer;
+                }
+                int words_before = vocabulary->words_count;
+                if (intern_word(vocabulary, word) < 0) {
+                    return -1;
+                }
+                if (vocabulary->words_count > words_before) {
+                    *strings_memory += allocation_size(strlen(word) + 1);
+                }
+                words_count++;
+            }
+        }
+    }
+    return words_count;
+}
+
+/**
+ * Memory of the words as separate allocations against an interned
+ * vocabulary, on the corpus and on a synthetic corpus of copies of it, and
+ * the size of a saved model against a front-coded one.
+ */
+static int benchmark_vocabulary(FILE *file, long copies) {
+    printf("%-16s %10s %9s %14s %14s %7s %12s\n", "corpus", "words",
+           "distinct", "strings (KiB)", "interned (KiB)", "saved",
+           "words/sec");
+    long corpus_copies[] = {1, copies};
+    for (int i = 0; i < 2; i++) {
+        Vocabulary *vocabulary = create_vocabulary();
+        if (!vocabulary) {
+            return EXIT_FAILURE;
+        }
+        size_t strings_memory;
+        clock_t start = clock();
+        long words_count = intern_corpus(file, corpus_copies[i], vocabulary,
+                                         &strings_memory);
+        double seconds = seconds_since(start);
+        if (words_count < 0) {
+            free_vocabulary(&vocabulary);
+            return EXIT_FAILURE;
+        }
+        compact_vocabulary(vocabulary);
+        char name[32];
+        sprintf(name, i == 0 ? "tweets" : "synthetic x%ld", corpus_copies[i]);
+        size_t memory = vocabulary_memory(vocabulary);
+        printf("%-16s %10ld %9d %14.0f %14.0f %6.0f%% %12.0f\n", name,
+               words_count, vocabulary->words_count,
+               (double) strings_memory / KIB, (double) memory / KIB,
+               100.0 * (1 - (double) memory / strings_memory),
+               words_count / seconds);
+        free_vocabulary(&vocabulary);
+    }
+
+    MarkovChain *markov_chain = create_word_chain();
+    FILE *plain = tmpfile();
+    FILE *front_coded = tmpfile();
+    rewind(file);
+    bool success = markov_chain && plain && front_coded &&
+                   train_word_chain(file, markov_chain, NULL, 0) ==
+                   EXIT_SUCCESS &&
+                   save_markov_chain(markov_chain, plain, &word_token) &&
+                   save_front_coded_model(markov_chain, front_coded,
+                                          &word_token);
+    if (success) {
+        printf("saved model: %ld bytes, front-coded: %ld bytes\n",
+               ftell(plain), ftell(front_coded));
+    }
+    if (markov_chain) {
+        free_markov_chain(&markov_chain);
+    }
+    if (plain) {
+        fclose(plain);
+    }
+    if (front_coded) {
+        fclose(front_coded);
+    }
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Add the lines of corpus, with their words as ids, to copy_filter.
+ */
+static void fill_copy_filter(CopyFilter *copy_filter, const WordCorpus *corpus,
+                             const int *ids) {
+    SequenceHasher hasher;
+    for (long i = 0; i < corpus->lines_count; i++) {
+        start_sequence_hash(&hasher);
+        for (long j = corpus->lines[i]; corpus->words[j] != NULL; j++) {
+            add_training_word(copy_filter, &hasher, (uint64_t) ids[j]);
+        }
+        add_training_line(copy_filter, &hasher);
+    }
+}
+
+/**
+ * Measured false positive rate of the copy filter against the estimated one,
+ * for a few wanted rates: the corpus lines and their n-grams are added, then
+ * sequences of random words, which are not in the corpus, are checked.
+ */
+static int benchmark_copies(FILE *file, long checks) {
+    WordCorpus corpus;
+    if (read_word_corpus(file, 1, &corpus)) {
+        return EXIT_FAILURE;
+    }
+    long slots_count = 0, words_count = 0;
+    for (long i = 0; i < corpus.lines_count; i++) {
+        long j = corpus.lines[i];
+        for (; corpus.words[j] != NULL; j++) {
+            words_count++;
+        }
+        slots_count = j + 1;
+    }
+    Vocabulary *vocabulary = create_vocabulary();
+    int *ids = malloc(sizeof(int) * (slots_count + 1));
+    bool success = vocabulary && ids;
+    for (long j = 0; success && j < slots_count; j++) {
+        if (corpus.words[j] != NULL) {
+            ids[j] = intern_word(vocabulary, corpus.words[j]);
+            success = ids[j] >= 0;
+        }
+    }
+    printf("%-6s %8s %11s %11s %11s %11s %14s\n", "rate", "KiB",
+           "lines est.", "lines", "n-grams est.", "n-grams", "checks/sec");
+    double rates[] = {0.1, 0.01, 0.001};
+    for (int r = 0; success && r < 3; r++) {
+        CopyFilter *copy_filter = create_copy_filter(corpus.lines_count,
+                                                     words_count,
+                                                     COPY_NGRAM_LENGTH,
+                                                     rates[r], 0);
+        if (!copy_filter) {
+            success = false;
+            break;
+        }
+        fill_copy_filter(copy_filter, &corpus, ids);
+        long line_hits = 0, ngram_hits = 0, ngram_checks = 0;
+        unsigned int seed = SEED;
+        SequenceHasher hasher;
+        clock_t start = clock();
+        for (long i = 0; i < checks; i++) {
+            start_sequence_hash(&hasher);
+            for (int k = 0; k < CHECKED_SEQUENCE_LENGTH; k++) {
+                int id = get_random_number_r(&seed, vocabulary->words_count);
+                ngram_hits += is_copied_word(copy_filter, &hasher,
+                                             (uint64_t) id);
+                ngram_checks += k + 1 >= COPY_NGRAM_LENGTH;
+            }
+            line_hits += is_copied_line(copy_filter, &hasher);
+        }
+        double seconds = seconds_since(start);
+        printf("%-6g %8.0f %10.4f%% %10.4f%% %11.4f%% %10.4f%% %14.0f\n",
+               rates[r], (double) copy_filter_memory(copy_filter) / KIB,
+               100 * bloom_filter_error_rate(copy_filter->lines),
+               100.0 * line_hits / checks,
+               100 * bloom_filter_error_rate(copy_filter->ngrams),
+               100.0 * ngram_hits / ngram_checks, checks / seconds);
+        free_copy_filter(&copy_filter);
+    }
+    free(ids);
+    free_vocabulary(&vocabulary);
+    free_word_corpus(&corpus);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Throughput of many sequences generated at once on one thread, every one of
+ * them advanced by a state in turn. A finished sequence is replaced by a new
+ * one, from a random first node.
+ */
+static int benchmark_streaming(MarkovChain *markov_chain, long states) {
+    int nodes_count = 0;
+    MarkovNode **nodes = malloc(sizeof(MarkovNode *) *
+                                markov_chain->database->size);
+    SequenceGenerator *generators = malloc(sizeof(SequenceGenerator) *
+                                           MAX_IN_FLIGHT);
+    if (!nodes || !generators) {
+        free(nodes);
+        free(generators);
+        return EXIT_FAILURE;
+    }
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        if (!node->data->has_dot && node->data->counter_lst_size > 0) {
+            nodes[nodes_count++] = node->data;
+        }
+    }
+    GenerationParams params = default_generation_params(SEQUENCE_MAX_LENGTH);
+    printf("%10s %14s %14s %16s\n", "in flight", "states/sec", "sequences",
+           "memory (bytes)");
+    for (int in_flight = 1; in_flight <= MAX_IN_FLIGHT; in_flight *= 10) {
+        unsigned int seed = SEED;
+        for (int i = 0; i < in_flight; i++) {
+            init_sequence_generator(
+                    &generators[i], markov_chain,
+                    nodes[get_random_number_r(&seed, nodes_count)], &params,
+                    seed);
+        }
+        long produced = 0, sequences = in_flight;
+        clock_t start = clock();
+        while (produced < states) {
+            for (int i = 0; i < in_flight; i++) {
+                if (next_sequence_node(&generators[i])) {
+                    produced++;
+                    continue;
+                }
+                init_sequence_generator(
+                        &generators[i], markov_chain,
+                        nodes[get_random_number_r(&seed, nodes_count)],
+                        &params, seed);
+                sequences++;
+            }
+        }
+        printf("%10d %14.0f %14ld %16lu\n", in_flight,
+               produced / seconds_since(start), sequences,
+               (unsigned long) (in_flight * sizeof(SequenceGenerator)));
+    }
+    free(nodes);
+    free(generators);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Time of sampling a successor of the states with at most INLINE_COUNTERS
+ * successors, which are kept in the node, and of the other states. The states
+ * of a group are visited in a random order, so consecutive samples don't
+ * touch the same memory.
+ */
+static int benchmark_successors(MarkovChain *markov_chain, long iterations) {
+    int size = markov_chain->database->size;
+    MarkovNode **nodes = malloc(sizeof(MarkovNode *) * (size + 1));
+    if (!nodes) {
+        return EXIT_FAILURE;
+    }
+    GenerationParams params = default_generation_params(SEQUENCE_MAX_LENGTH);
+    printf("%-22s %8s %14s\n", "successors", "states", "ns/sample");
+    for (int inline_group = 1; inline_group >= 0; inline_group--) {
+        int nodes_count = 0;
+        for (Node *node = markov_chain->database->first; node != NULL;
+             node = node->next) {
+            int successors = node->data->counter_lst_size;
+            if (successors > 0 &&
+                (successors <= INLINE_COUNTERS) == inline_group) {
+                nodes[nodes_count++] = node->data;
+            }
+        }
+        for (int i = nodes_count - 1; i > 0; i--) {
+            int j = get_random_number(i + 1);
+            MarkovNode *tmp = nodes[i];
+            nodes[i] = nodes[j];
+            nodes[j] = tmp;
+        }
+        clock_t start = clock();
+        for (long i = 0; i < iterations; i++) {
+            get_next_sampled_node(nodes[i % nodes_count], &params);
+        }
+        double seconds = seconds_since(start);
+        char group[32];
+        sprintf(group, inline_group ? "1 to %d" : "more than %d",
+                INLINE_COUNTERS);
+        printf("%-22s %8d %14.1f\n", group, nodes_count,
+               1e9 * seconds / iterations);
+    }
+    free(nodes);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Train a chain of words on the file, reporting how long it took.
+ * @return the trained chain, NULL in case of allocation failure
+ */
+static MarkovChain *load_word_chain(FILE *file) {
+    MarkovChain *markov_chain = create_word_chain();
+    if (!markov_chain) {
+        return NULL;
+    }
+    clock_t start = clock();
+    if (train_word_chain(file, markov_chain, NULL, 0)) {
+        free_markov_chain(&markov_chain);
+        return NULL;
+    }
+    printf("trained %d states in %.2fs\n", markov_chain->database->size,
+           seconds_since(start));
+    return markov_chain;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stdout, USAGE_MSG);
+        return EXIT_FAILURE;
+    }
+    long count = 0;
+    if (argc > 3) {
+        count = strtol(argv[3], NULL, DECIMAL_BASE);
+    }
+    srand(SEED);
+
+    FILE *file = fopen(argv[2], "r");
+    if (!file) {
+        fprintf(stdout, FILE_PATH_ERROR);
+        return EXIT_FAILURE;
+    }
+    int result = EXIT_FAILURE;
+    if (strcmp(argv[1], "sampling") == 0) {
+        MarkovChain *markov_chain = load_word_chain(file);
+        if (markov_chain) {
+            result = benchmark_sampling(markov_chain,
+                                        count ? count : DEFAULT_ITERATIONS);
+            free_markov_chain(&markov_chain);
+        }
+    } else if (strcmp(argv[1], "external") == 0) {
+        result = benchmark_external(file,
+                                    count ? count : DEFAULT_CORPUS_COPIES);
+    } else if (strcmp(argv[1], "pruning") == 0) {
+        result = benchmark_pruning(file);
+    } else if (strcmp(argv[1], "concurrent") == 0) {
+        result = benchmark_concurrent(file,
+                                      count ? count : DEFAULT_TRAINING_COPIES);
+    } else if (strcmp(argv[1], "streaming") == 0) {
+        MarkovChain *markov_chain = load_word_chain(file);
+        if (markov_chain) {
+            result = benchmark_streaming(markov_chain,
+                                         count ? count : DEFAULT_ITERATIONS);
+            free_markov_chain(&markov_chain);
+        }
+    } else if (strcmp(argv[1], "successors") == 0) {
+        MarkovChain *markov_chain = load_word_chain(file);
+        if (markov_chain) {
+            result = benchmark_successors(markov_chain,
+                                          count ? count : DEFAULT_ITERATIONS);
+            free_markov_chain(&markov_chain);
+        }
+    } else if (strcmp(argv[1], "vocabulary") == 0) {
+        result = benchmark_vocabulary(file,
+                                      count ? count : DEFAULT_SYNTHETIC_COPIES);
+    } else if (strcmp(argv[1], "copies") == 0) {
+        result = benchmark_copies(file, count ? count : DEFAULT_COPY_CHECKS);
+    } else {
+        fprintf(stdout, USAGE_MSG);
+    }
+    fclose(file);
+    return result;
+}
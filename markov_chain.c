@@ -1,5 +1,6 @@
 #include "markov_chain.h"
 #include <string.h>
+#include <math.h> // For pow(), ceil()
 
 #define LINE_LENGTH 1001
 
@@ -15,12 +16,83 @@ int get_random_number(int max_number)
 
 
 /**
- * Get one random state from the given markov_chain's database.
+* Get random number between 0 and max_number [0, max_number) from the given
+* random state instead of the one of rand(), so threads and generators can
+* each have their own.
+* @param seed random state, updated by the call
+* @param max_number maximal number to return (not including)
+* @return Random number
+*/
+int get_random_number_r(unsigned int *seed, int max_number)
+{
+    // 32 bit linear congruential step, scaled by it's high bits
+    *seed = *seed * 1664525u + 1013904223u;
+    return (int) (((unsigned long long) *seed * max_number) >> 32);
+}
+
+
+/**
+ * Get one random state from the given markov_chain's database. The state is
+ * not a last state and has successors, so a sentence can start with it.
  * @param markov_chain
  * @return
  */
 MarkovNode *get_first_random_node(MarkovChain *markov_chain) {
-    if(!markov_chain){
+    return get_first_random_node_r(markov_chain, NULL);
+}
+
+
+/**
+ * Check whether markov_chain has a state a sentence can start with: a state
+ * that is not a last state and has successors. get_first_random_node only
+ * returns if there is one.
+ * @param markov_chain
+ * @return true if there is such a state, false otherwise
+ */
+bool has_first_node(MarkovChain *markov_chain) {
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        if (!markov_chain->is_last(node->data->data) &&
+            node->data->counter_lst_size > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Draw a random number between 0 and max_number [0, max_number) from seed, or
+ * from rand() if seed is NULL.
+ */
+static int draw_random(unsigned int *seed, int max_number)
+{
+    return seed ? get_random_number_r(seed, max_number)
+                : get_random_number(max_number);
+}
+
+
+/**
+ * Draw a random fraction in [0, 1) from seed, or from rand() if seed is NULL.
+ */
+static double draw_fraction(unsigned int *seed)
+{
+    if (!seed) {
+        return rand() / ((double) RAND_MAX + 1);
+    }
+    return get_random_number_r(seed, RAND_MAX) / (double) RAND_MAX;
+}
+
+
+/**
+ * Same as get_first_random_node, drawing from the given random state.
+ * @param markov_chain
+ * @param seed random state, NULL to use rand()
+ * @return
+ */
+MarkovNode *get_first_random_node_r(MarkovChain *markov_chain,
+                                    unsigned int *seed) {
+    if(!markov_chain || markov_chain->database->size == 0){
         return NULL;
     }
     LinkedList *database = markov_chain->database;
@@ -29,34 +101,170 @@ MarkovNode *get_first_random_node(MarkovChain *markov_chain) {
 
     while (true) {
         Node *random_node = current_node;
-        int i = get_random_number(database->size);
+        int i = draw_random(seed, database->size);
         for (int j = 1; j <= i; j++) {
             random_node = random_node->next;
         }
 
-        if (markov_chain->is_last(random_node->data->data) == false) {
+        if (markov_chain->is_last(random_node->data->data) == false &&
+            random_node->data->counter_lst_size > 0) {
             return random_node->data;
         }
     }
 }
 
 
+/**
+ * Find the first counter whose cumulative frequency is bigger than value.
+ * @param counter_list counters sorted by descending frequency
+ * @param size number of counters to search in
+ * @param value number in [0, cumulative frequency of the last counter)
+ * @return index of the found counter
+ */
+static int find_cumulative(NextNodeCounter *counter_list, int size, int value)
+{
+    int low = 0, high = size - 1;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (counter_list[middle].cumulative_freq > value) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+
+/**
+ * Find the end of the run of counters that have the same frequency as the
+ * counter at start.
+ * @param counter_list counters sorted by descending frequency
+ * @param start first counter of the run
+ * @param size number of counters to search in
+ * @return index of the first counter after the run
+ */
+static int find_run_end(NextNodeCounter *counter_list, int start, int size)
+{
+    int frequency = counter_list[start].frequency;
+    int low = start + 1, high = size;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (counter_list[middle].frequency < frequency) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+
 /**
  * Choose randomly the next state, depend on it's occurrence frequency.
  * @param state_struct_ptr MarkovNode to choose from
  * @return MarkovNode of the chosen state
  */
 MarkovNode *get_next_random_node(MarkovNode *state_struct_ptr) {
+    if (state_struct_ptr->counter_lst_size == 0) {
+        return NULL;
+    }
+    if (state_struct_ptr->counter_lst_size == 1) {
+        return state_struct_ptr->counter_list[0].markov_node; // no choice
+    }
     int i = get_random_number(state_struct_ptr->freq_sum);
+    int j = find_cumulative(state_struct_ptr->counter_list,
+                            state_struct_ptr->counter_lst_size, i);
+    return state_struct_ptr->counter_list[j].markov_node;
+}
+
+
+/**
+ * Get generation params that sample by the plain occurrence frequencies.
+ * @param max_length maximum length of chain to generate
+ * @return params with no truncation and temperature 1
+ */
+GenerationParams default_generation_params(int max_length) {
+    return (GenerationParams) {max_length, 0, 1.0, 1.0};
+}
+
+
+/**
+ * Choose randomly the next state with the given sampling controls. Uses
+ * prefix truncation and binary search over the cumulative frequencies, so no
+ * sorting is done while sampling.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param params sampling controls
+ * @return MarkovNode of the chosen state, NULL if it has no successors
+ */
+MarkovNode *get_next_sampled_node(MarkovNode *state_struct_ptr,
+                                  const GenerationParams *params) {
+    return get_next_sampled_node_r(state_struct_ptr, params, NULL);
+}
+
+
+/**
+ * Same as get_next_sampled_node, drawing from the given random state.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param params sampling controls
+ * @param seed random state, NULL to use rand()
+ * @return MarkovNode of the chosen state, NULL if it has no successors
+ */
+MarkovNode *get_next_sampled_node_r(MarkovNode *state_struct_ptr,
+                                    const GenerationParams *params,
+                                    unsigned int *seed) {
     NextNodeCounter *counter_list = state_struct_ptr->counter_list;
-    for(int j=0; j<state_struct_ptr->counter_lst_size; j++){
-        if(counter_list[j].frequency <= i){
-            i -= counter_list[j].frequency;
-        }else{
-            return counter_list[j].markov_node;
+    int size = state_struct_ptr->counter_lst_size;
+    if (size == 0) {
+        return NULL;
+    }
+    if (params->temperature <= 0) {
+        return counter_list[0].markov_node;
+    }
+    if (params->top_k > 0 && params->top_k < size) {
+        size = params->top_k;
+    }
+    if (params->top_p < 1) {
+        // the shortest prefix whose frequencies reach top_p of the sum:
+        int needed = (int) ceil(params->top_p * state_struct_ptr->freq_sum);
+        int prefix = find_cumulative(counter_list, size, needed - 1) + 1;
+        if (prefix < size) {
+            size = prefix;
         }
     }
-    return NULL;
+
+    if (size == 1) {
+        return counter_list[0].markov_node; // no choice, nothing to draw
+    }
+    if (params->temperature == 1) {
+        int i = draw_random(seed, counter_list[size - 1].cumulative_freq);
+        return counter_list[find_cumulative(counter_list, size, i)]
+                .markov_node;
+    }
+    // counters with the same frequency have the same weight, so the weights
+    // are summed run by run; there are few distinct frequencies per node.
+    // Frequencies are divided by the top one so a low temperature can't
+    // overflow the weights: they stay in (0, 1], and the top one is 1.
+    double exponent = 1 / params->temperature;
+    double top_frequency = counter_list[0].frequency;
+    double weights_sum = 0;
+    for (int j = 0; j < size; j = find_run_end(counter_list, j, size)) {
+        weights_sum += (find_run_end(counter_list, j, size) - j) *
+                       pow(counter_list[j].frequency / top_frequency,
+                           exponent);
+    }
+    double i = weights_sum * draw_fraction(seed);
+    for (int j = 0; j < size;) {
+        int run_end = find_run_end(counter_list, j, size);
+        double weight = pow(counter_list[j].frequency / top_frequency,
+                            exponent);
+        if (weight * (run_end - j) > i) {
+            return counter_list[j + (int) (i / weight)].markov_node;
+        }
+        i -= weight * (run_end - j);
+        j = run_end;
+    }
+    return counter_list[size - 1].markov_node;
 }
 
 
@@ -70,32 +278,131 @@ MarkovNode *get_next_random_node(MarkovNode *state_struct_ptr) {
  */
 void generate_random_sequence(MarkovChain *markov_chain, MarkovNode *
 first_node, int max_length) {
+    GenerationParams params = default_generation_params(max_length);
+    generate_sequence(markov_chain, first_node, &params);
+}
+
+
+/**
+ * Same as generate_random_sequence, with the given sampling controls.
+ * @param markov_chain
+ * @param first_node markov_node to start with,
+ *                   if NULL- choose a random markov_node
+ * @param params sampling controls and maximum length of chain to generate
+ */
+void generate_sequence(MarkovChain *markov_chain, MarkovNode *first_node,
+                       const GenerationParams *params) {
     if(!first_node){
         first_node = get_first_random_node(markov_chain);
     }
     int length = 0;
-//    char tweet[LINE_LENGTH];
-//    strcpy(tweet, first_node->data);
-//    strcat(tweet, " ");
-//    markov_chain->print_func(first_node->data);
     MarkovNode *current_node = first_node;
-//    MarkovNode *current_node = get_next_random_node(first_node);
-    while(length < max_length){
-//        strcat(tweet, current_node->data);
-
+    while(current_node != NULL && length < params->max_length){
         if(markov_chain->is_last(current_node->data)){
             markov_chain->print_func(current_node->data);
           break;
         }
         markov_chain->print_func(current_node->data);
-//        strcat(tweet, " ");
-        current_node = get_next_random_node(current_node);
+        current_node = get_next_sampled_node(current_node, params);
         length ++;
+    }
+}
+
+
+/**
+ * Start generating a sequence. No memory is allocated, the generator is
+ * advanced by next_sequence_node.
+ * @param generator generator to initialize
+ * @param markov_chain
+ * @param first_node markov_node to start with,
+ *                   if NULL- choose a random markov_node
+ * @param params sampling controls and maximum length of chain to generate
+ * @param seed initial random state of the generator
+ */
+void init_sequence_generator(SequenceGenerator *generator,
+                             MarkovChain *markov_chain,
+                             MarkovNode *first_node,
+                             const GenerationParams *params,
+                             unsigned int seed) {
+    generator->markov_chain = markov_chain;
+    generator->seed = seed;
+    generator->remaining = params->max_length;
+    generator->params = *params;
+    generator->current = first_node ? first_node :
+                         get_first_random_node_r(markov_chain,
+                                                 &generator->seed);
+}
+
+
+/**
+ * Get the next state of the sequence: the states generate_sequence would
+ * print, one at a time.
+ * @param generator
+ * @return the next state, NULL once the sequence is over
+ */
+MarkovNode *next_sequence_node(SequenceGenerator *generator) {
+    MarkovNode *markov_node = generator->current;
+    if (!markov_node || generator->remaining <= 0) {
+        generator->current = NULL;
+        return NULL;
+    }
+    generator->remaining--;
+    if (generator->remaining == 0 ||
+        generator->markov_chain->is_last(markov_node->data)) {
+        generator->current = NULL;
+    } else {
+        generator->current = get_next_sampled_node_r(markov_node,
+                                                     &generator->params,
+                                                     &generator->seed);
+    }
+    return markov_node;
+}
+
+
+/**
+ * Check whether the counter_list of markov_node was moved to the heap.
+ */
+static bool has_heap_counters(const MarkovNode *markov_node) {
+    return markov_node->counter_list != NULL &&
+           markov_node->counter_list != markov_node->inline_counters;
+}
+
 
+/**
+ * Free the counter_list of markov_node if it is on the heap.
+ */
+static void free_counter_list(MarkovNode *markov_node) {
+    if (has_heap_counters(markov_node)) {
+        free(markov_node->counter_list);
     }
-//    strcat (tweet, "\n");
-//    fprintf(stdout, "%s", tweet);
-//    strcpy(tweet, " ");
+}
+
+
+/**
+ * Make room for one more counter in the counter_list of markov_node. The
+ * first INLINE_COUNTERS counters are kept in the node, and all of them are
+ * moved to the heap when there are more.
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+static bool grow_counter_list(MarkovNode *markov_node) {
+    int size = markov_node->counter_lst_size;
+    if (size < INLINE_COUNTERS) {
+        markov_node->counter_list = markov_node->inline_counters;
+        return true;
+    }
+    bool on_heap = has_heap_counters(markov_node);
+    NextNodeCounter *tmp = realloc(on_heap ? markov_node->counter_list : NULL,
+                                   sizeof(NextNodeCounter) * (size + 1));
+    if (!tmp) {
+        return false;
+    }
+    if (!on_heap) {
+        memcpy(tmp, markov_node->inline_counters,
+               sizeof(NextNodeCounter) * size);
+    }
+    markov_node->counter_list = tmp;
+    return true;
 }
 
 
@@ -112,7 +419,7 @@ void free_markov_chain(MarkovChain ** ptr_chain){
         tmp = head;
         head = head->next;
         markov_chain->free_data(tmp->data->data);
-        free(tmp->data->counter_list);
+        free_counter_list(tmp->data);
         free(tmp->data);
         free(tmp);
     }
@@ -121,6 +428,133 @@ void free_markov_chain(MarkovChain ** ptr_chain){
 }
 
 
+/**
+ * Drop the successors of every state whose frequency is less than
+ * min_frequency, then remove the states that are left with no successors and
+ * are not the successor of any state. The counter lists are sorted, so the
+ * dropped successors are a suffix of them.
+ * @param markov_chain
+ * @param min_frequency minimal frequency of a successor to keep
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool prune_markov_chain(MarkovChain *markov_chain, int min_frequency) {
+    LinkedList *database = markov_chain->database;
+    bool *referenced = calloc(database->size + 1, sizeof(bool));
+    if (!referenced) {
+        return false;
+    }
+    for (Node *node = database->first; node != NULL; node = node->next) {
+        MarkovNode *markov_node = node->data;
+        int size = 0;
+        while (size < markov_node->counter_lst_size &&
+               markov_node->counter_list[size].frequency >= min_frequency) {
+            referenced[markov_node->counter_list[size].markov_node->index] =
+                    true;
+            size++;
+        }
+        if (size == markov_node->counter_lst_size) {
+            continue;
+        }
+        markov_node->counter_lst_size = size;
+        markov_node->freq_sum = size > 0 ?
+                markov_node->counter_list[size - 1].cumulative_freq : 0;
+        if (size == 0) {
+            free_counter_list(markov_node);
+            markov_node->counter_list = NULL;
+            continue;
+        }
+        if (!has_heap_counters(markov_node)) {
+            continue;
+        }
+        if (size <= INLINE_COUNTERS) {
+            memcpy(markov_node->inline_counters, markov_node->counter_list,
+                   sizeof(NextNodeCounter) * size);
+            free(markov_node->counter_list);
+            markov_node->counter_list = markov_node->inline_counters;
+            continue;
+        }
+        NextNodeCounter *tmp = realloc(markov_node->counter_list,
+                                       sizeof(NextNodeCounter) * size);
+        if (tmp) { // a failure to shrink keeps the bigger list
+            markov_node->counter_list = tmp;
+        }
+    }
+
+    Node *prev = NULL, *node = database->first;
+    int index = 0;
+    while (node != NULL) {
+        Node *next = node->next;
+        MarkovNode *markov_node = node->data;
+        if (markov_node->counter_lst_size == 0 &&
+            !referenced[markov_node->index]) {
+            if (prev) {
+                prev->next = next;
+            } else {
+                database->first = next;
+            }
+            markov_chain->free_data(markov_node->data);
+            free(markov_node);
+            free(node);
+            database->size--;
+        } else {
+            markov_node->index = index++;
+            prev = node;
+        }
+        node = next;
+    }
+    database->last = prev;
+    free(referenced);
+    return true;
+}
+
+
+/**
+ * Add amount to the frequency of the i-th counter of markov_node, keeping the
+ * counter_list sorted by descending frequency and it's cumulative frequencies
+ * up to date. Costs as much as the search that found the counter.
+ * @param markov_node node whose counter_list to update
+ * @param i index of the counter to increment
+ * @param amount number to add to the frequency
+ */
+static void increment_counter(MarkovNode *markov_node, int i, int amount) {
+    NextNodeCounter *counter_list = markov_node->counter_list;
+    NextNodeCounter counter = counter_list[i];
+    int j = i;
+    if (amount == 1) {
+        // swap it with the first counter of it's frequency, which keeps the
+        // order of the other counters as training always had it
+        while (j > 0 && counter_list[j - 1].frequency == counter.frequency) {
+            j--;
+        }
+        counter_list[i].markov_node = counter_list[j].markov_node;
+        counter_list[j].markov_node = counter.markov_node;
+        counter_list[j].frequency++;
+        for (int k = j; k < markov_node->counter_lst_size; k++) {
+            counter_list[k].cumulative_freq++;
+        }
+        markov_node->freq_sum++;
+        return;
+    }
+    counter.frequency += amount;
+    // move it before all the counters that are now less frequent:
+    while (j > 0 && counter_list[j - 1].frequency < counter.frequency) {
+        counter_list[j] = counter_list[j - 1];
+        j--;
+    }
+    counter_list[j] = counter;
+    int cumulative_freq = j > 0 ? counter_list[j - 1].cumulative_freq : 0;
+    for (int k = j; k <= i; k++) {
+        cumulative_freq += counter_list[k].frequency;
+        counter_list[k].cumulative_freq = cumulative_freq;
+    }
+    for (int k = i + 1; k < markov_node->counter_lst_size; k++) {
+        counter_list[k].cumulative_freq += amount;
+    }
+    markov_node->freq_sum += amount;
+}
+
+
 /**
  * Add the second markov_node to the counter list of the first markov_node.
  * If already in list, update it's counter value.
@@ -131,55 +565,45 @@ void free_markov_chain(MarkovChain ** ptr_chain){
  */
 bool add_node_to_counter_list(MarkovNode *first_node, MarkovNode
 *second_node, MarkovChain *markov_chain) {
-    if (!first_node | !second_node) {
+    return add_frequency_to_counter_list(first_node, second_node,
+                                         markov_chain, 1);
+}
+
+
+/**
+ * Add frequency occurrences of the second markov_node to the counter list of
+ * the first markov_node. If already in list, update it's counter value.
+ * @param first_node
+ * @param second_node
+ * @param markov_chain
+ * @param frequency number of occurrences to add, positive
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_frequency_to_counter_list(MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain, int frequency) {
+    if (!first_node || !second_node || frequency <= 0) {
         return false;
     }
-//    char *searched_word = malloc(sizeof(char)*(strlen(second_node->data)+1));
-//    strcpy(searched_word, second_node->data);
     void* searched_word = markov_chain->copy_func(second_node->data);
-    if (first_node->counter_list) {
-        int i = 0;
-        for (; i < first_node->counter_lst_size; i++) {
-            void *word = first_node->counter_list[i].markov_node->data;
-            if (markov_chain->comp_func(word, searched_word) == 0) {
-                first_node->counter_list[i].frequency++;
-                first_node->freq_sum++;
-                markov_chain->free_data(searched_word);
-//                free(searched_word);
-                return true;
-            }
-        }
-        NextNodeCounter *tmp = realloc(first_node->counter_list,
-                                       sizeof(NextNodeCounter)*
-                                       (first_node->counter_lst_size+1));
-        if (!tmp) {
-            free(searched_word);
-            return false;
-        }
-        first_node->counter_list = tmp;
-        first_node->counter_list[i].markov_node = second_node;
-        first_node->counter_list[i].frequency = 1;
-        first_node->freq_sum++;
-        first_node->counter_lst_size++;
-//        free(searched_word);
-        markov_chain->free_data(searched_word);
-        return true;
-    } else {
-        first_node->counter_list = malloc(sizeof(NextNodeCounter));
-        if (!first_node->counter_list) {
-//            free(searched_word);
+    int i = 0;
+    for (; i < first_node->counter_lst_size; i++) {
+        void *word = first_node->counter_list[i].markov_node->data;
+        if (markov_chain->comp_func(word, searched_word) == 0) {
+            increment_counter(first_node, i, frequency);
             markov_chain->free_data(searched_word);
-            return false;
+            return true;
         }
-        first_node->counter_list[0].markov_node = second_node;
-        first_node->counter_list[0].frequency = 1;
-        first_node->counter_lst_size++;
-        first_node->freq_sum = 1;
-//        free(searched_word);
-        markov_chain->free_data(searched_word);
-        return true;
     }
-
+    markov_chain->free_data(searched_word);
+    if (!grow_counter_list(first_node)) {
+        return false;
+    }
+    first_node->counter_list[i] = (NextNodeCounter) {second_node, 0,
+                                                     first_node->freq_sum};
+    first_node->counter_lst_size++;
+    increment_counter(first_node, i, frequency);
+    return true;
 }
 
 
@@ -225,6 +649,7 @@ Node *create_new_node(void *data_ptr, MarkovChain *markov_chain) {
         return NULL;
     }
     new_markov_node->data = searched_word;
+    new_markov_node->index = database->size;
     new_markov_node->has_dot = false;
     if (markov_chain->is_last(new_markov_node->data)) {
         new_markov_node->has_dot = true;
@@ -7,6 +7,7 @@
 #include <stdbool.h> // for bool
 
 #define ALLOCATION_ERROR_MASSAGE "Allocation failure: Failed to allocate new memory\n"
+#define INLINE_COUNTERS 2
 
 
 /***************************/
@@ -25,18 +26,38 @@ typedef bool (*is_last) (const void *);
 /*        STRUCTS          */
 /***************************/
 
+/* A counter_list is kept in descending frequency order, so the most likely
+ * successors are a prefix of it. */
+typedef struct NextNodeCounter {
+    struct MarkovNode *markov_node;
+    int frequency;
+    int cumulative_freq; // sum of the frequencies up to and including this one
+} NextNodeCounter;
+
 typedef struct MarkovNode {
     void *data;
+    int index; // position of the node in the chain's database
     int has_dot;
-    struct NextNodeCounter *counter_list;
+    struct NextNodeCounter *counter_list; // inline_counters while they are
+                                          // enough, a heap array after that
     int counter_lst_size;
     int freq_sum;
+    // most states have few successors, they are kept in the node itself
+    struct NextNodeCounter inline_counters[INLINE_COUNTERS];
 } MarkovNode;
 
-typedef struct NextNodeCounter {
-    struct MarkovNode *markov_node;
-    int frequency;
-} NextNodeCounter;
+/**
+ * Controls of the generation. Top-k and top-p truncate the counter_list by the
+ * raw frequencies, temperature reshapes the truncated frequencies.
+ */
+typedef struct GenerationParams {
+    int max_length;     // maximum length of chain to generate
+    int top_k;          // keep only the k most frequent successors, 0 for all
+    double top_p;       // keep the most frequent successors covering top_p of
+                        // the frequencies, 1 for all
+    double temperature; // 1 keeps the frequencies, < 1 sharpens them, > 1
+                        // flattens them, 0 always picks the most frequent
+} GenerationParams;
 
 /* DO NOT ADD or CHANGE variable names in this struct */
 typedef struct MarkovChain
@@ -72,12 +93,61 @@ typedef struct MarkovChain
 } MarkovChain;
 
 /**
- * Get one random state from the given markov_chain's database.
+ * A sequence that is generated one state at a time. It holds everything the
+ * generation needs and allocates nothing, so any number of sequences can be
+ * in progress at once.
+ */
+typedef struct SequenceGenerator {
+    MarkovChain *markov_chain;
+    MarkovNode *current; // next state to return, NULL once finished
+    unsigned int seed;   // random state of this sequence
+    int remaining;       // number of states left to return
+    GenerationParams params;
+} SequenceGenerator;
+
+/**
+* Get random number between 0 and max_number [0, max_number).
+* @param max_number maximal number to return (not including)
+* @return Random number
+*/
+int get_random_number(int max_number);
+
+/**
+* Get random number between 0 and max_number [0, max_number) from the given
+* random state instead of the one of rand(), so threads and generators can
+* each have their own.
+* @param seed random state, updated by the call
+* @param max_number maximal number to return (not including)
+* @return Random number
+*/
+int get_random_number_r(unsigned int *seed, int max_number);
+
+/**
+ * Check whether markov_chain has a state a sentence can start with: a state
+ * that is not a last state and has successors. get_first_random_node only
+ * returns if there is one.
+ * @param markov_chain
+ * @return true if there is such a state, false otherwise
+ */
+bool has_first_node(MarkovChain *markov_chain);
+
+/**
+ * Get one random state from the given markov_chain's database. The state is
+ * not a last state and has successors, so a sentence can start with it.
  * @param markov_chain
- * @return
+ * @return the state, NULL if the database is empty
  */
 MarkovNode* get_first_random_node(MarkovChain *markov_chain);
 
+/**
+ * Same as get_first_random_node, drawing from the given random state.
+ * @param markov_chain
+ * @param seed random state, NULL to use rand()
+ * @return the state, NULL if the database is empty
+ */
+MarkovNode* get_first_random_node_r(MarkovChain *markov_chain,
+                                    unsigned int *seed);
+
 /**
  * Choose randomly the next state, depend on it's occurrence frequency.
  * @param state_struct_ptr MarkovNode to choose from
@@ -85,6 +155,35 @@ MarkovNode* get_first_random_node(MarkovChain *markov_chain);
  */
 MarkovNode* get_next_random_node(MarkovNode *state_struct_ptr);
 
+/**
+ * Get generation params that sample by the plain occurrence frequencies.
+ * @param max_length maximum length of chain to generate
+ * @return params with no truncation and temperature 1
+ */
+GenerationParams default_generation_params(int max_length);
+
+/**
+ * Choose randomly the next state with the given sampling controls. Uses
+ * prefix truncation and binary search over the cumulative frequencies, so no
+ * sorting is done while sampling.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param params sampling controls
+ * @return MarkovNode of the chosen state, NULL if it has no successors
+ */
+MarkovNode* get_next_sampled_node(MarkovNode *state_struct_ptr,
+                                  const GenerationParams *params);
+
+/**
+ * Same as get_next_sampled_node, drawing from the given random state.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param params sampling controls
+ * @param seed random state, NULL to use rand()
+ * @return MarkovNode of the chosen state, NULL if it has no successors
+ */
+MarkovNode* get_next_sampled_node_r(MarkovNode *state_struct_ptr,
+                                    const GenerationParams *params,
+                                    unsigned int *seed);
+
 /**
  * Receive markov_chain, generate and print random sentence out of it. The
  * sentence most have at least 2 words in it.
@@ -95,6 +194,39 @@ MarkovNode* get_next_random_node(MarkovNode *state_struct_ptr);
 void generate_random_sequence(MarkovChain *markov_chain, MarkovNode *
 first_node, int max_length);
 
+/**
+ * Same as generate_random_sequence, with the given sampling controls.
+ * @param markov_chain
+ * @param first_node markov_node to start with, if NULL- choose a random markov_node
+ * @param params sampling controls and maximum length of chain to generate
+ */
+void generate_sequence(MarkovChain *markov_chain, MarkovNode *first_node,
+                       const GenerationParams *params);
+
+/**
+ * Start generating a sequence. No memory is allocated, the generator is
+ * advanced by next_sequence_node.
+ * @param generator generator to initialize
+ * @param markov_chain
+ * @param first_node markov_node to start with,
+ *                   if NULL- choose a random markov_node
+ * @param params sampling controls and maximum length of chain to generate
+ * @param seed initial random state of the generator
+ */
+void init_sequence_generator(SequenceGenerator *generator,
+                             MarkovChain *markov_chain,
+                             MarkovNode *first_node,
+                             const GenerationParams *params,
+                             unsigned int seed);
+
+/**
+ * Get the next state of the sequence: the states generate_sequence would
+ * print, one at a time.
+ * @param generator
+ * @return the next state, NULL once the sequence is over
+ */
+MarkovNode* next_sequence_node(SequenceGenerator *generator);
+
 /**
  * Free markov_chain and all of it's content from memory
  * @param markov_chain markov_chain to free
@@ -103,7 +235,8 @@ void free_markov_chain(MarkovChain **markov_chain);
 
 /**
  * Add the second markov_node to the counter list of the first markov_node.
- * If already in list, update it's counter value.
+ * If already in list, update it's counter value. The counter list stays
+ * sorted by descending frequency.
  * @param first_node
  * @param second_node
  * @param markov_chain
@@ -113,6 +246,30 @@ void free_markov_chain(MarkovChain **markov_chain);
 bool add_node_to_counter_list(MarkovNode *first_node, MarkovNode
 *second_node, MarkovChain *markov_chain);
 
+/**
+ * Add frequency occurrences of the second markov_node to the counter list of
+ * the first markov_node. If already in list, update it's counter value.
+ * @param first_node
+ * @param second_node
+ * @param markov_chain
+ * @param frequency number of occurrences to add, positive
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_frequency_to_counter_list(MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain, int frequency);
+
+/**
+ * Drop the successors of every state whose frequency is less than
+ * min_frequency, then remove the states that are left with no successors and
+ * are not the successor of any state.
+ * @param markov_chain
+ * @param min_frequency minimal frequency of a successor to keep
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool prune_markov_chain(MarkovChain *markov_chain, int min_frequency);
+
 /**
 * Check if data_ptr is in database. If so, return the markov_node wrapping it in
  * the markov_chain, otherwise return NULL.
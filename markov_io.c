@@ -0,0 +1,477 @@
+#include "markov_io.h"
+#include "vocabulary.h"
+#include <string.h>
+#include <limits.h> // For INT_MAX
+
+#define MODEL_LINE_LENGTH (2 * MODEL_TOKEN_LENGTH + 32)
+#define DECIMAL_BASE 10
+
+typedef enum ModelFormat {
+    FORMAT_NONE,
+    FORMAT_PLAIN,
+    FORMAT_FRONT_CODED
+} ModelFormat;
+
+typedef enum RecordKind {
+    RECORD_STATE,
+    RECORD_EDGE,
+    RECORD_END
+} RecordKind;
+
+/**
+ * The current record of a saved model that is read one record at a time.
+ */
+typedef struct ModelReader {
+    FILE *file;
+    RecordKind kind;
+    char state[MODEL_TOKEN_LENGTH];     // state of the current record
+    char successor[MODEL_TOKEN_LENGTH]; // only for edge records
+    long frequency;                     // only for edge records
+    Vocabulary *tokens; // tokens of a front-coded model, NULL for a plain one
+} ModelReader;
+
+typedef struct TokenEntry {
+    const char *token;
+    MarkovNode *markov_node;
+    int frequency;
+    int id; // position of the token in a front-coded model
+} TokenEntry;
+
+
+static int compare_token_entries(const void *first, const void *second) {
+    return strcmp(((const TokenEntry *) first)->token,
+                  ((const TokenEntry *) second)->token);
+}
+
+
+static int compare_token_ids(const void *first, const void *second) {
+    return ((const TokenEntry *) first)->id -
+           ((const TokenEntry *) second)->id;
+}
+
+
+/**
+ * Write the sorted tokens of a front-coded model.
+ */
+static void write_tokens(const TokenEntry *states, int states_count,
+                         FILE *file) {
+    fprintf(file, "V %d\n", states_count);
+    const char *prev = "";
+    for (int i = 0; i < states_count; i++) {
+        size_t shared = 0;
+        while (prev[shared] != '\0' &&
+               prev[shared] == states[i].token[shared]) {
+            shared++;
+        }
+        fprintf(file, "%lu %s\n", (unsigned long) shared,
+                states[i].token + shared);
+        prev = states[i].token;
+    }
+}
+
+
+/**
+ * Save markov_chain to file, in the plain or the front-coded format.
+ * @return true on success, false in case of allocation or write error
+ */
+static bool save_model(MarkovChain *markov_chain, FILE *file,
+                       token_func to_token, bool front_coded) {
+    if (!markov_chain || !file || !to_token) {
+        return false;
+    }
+    int states_count = markov_chain->database->size;
+    int max_successors = 0;
+    TokenEntry *states = malloc(sizeof(TokenEntry) * (states_count + 1));
+    // token ids by the index of the states, for front-coded edges
+    int *ids = malloc(sizeof(int) * (states_count + 1));
+    if (!states || !ids) {
+        free(states);
+        free(ids);
+        return false;
+    }
+    int i = 0;
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next, i++) {
+        states[i] = (TokenEntry) {to_token(node->data->data), node->data, 0,
+                                  0};
+        if (node->data->counter_lst_size > max_successors) {
+            max_successors = node->data->counter_lst_size;
+        }
+    }
+    qsort(states, states_count, sizeof(TokenEntry), compare_token_entries);
+    TokenEntry *edges = malloc(sizeof(TokenEntry) * (max_successors + 1));
+    if (!edges) {
+        free(states);
+        free(ids);
+        return false;
+    }
+
+    if (front_coded) {
+        fprintf(file, "%s\n", FRONT_CODED_MODEL_HEADER);
+        write_tokens(states, states_count, file);
+        for (i = 0; i < states_count; i++) {
+            ids[states[i].markov_node->index] = i;
+        }
+    } else {
+        fprintf(file, "%s\n", MODEL_HEADER);
+    }
+    for (i = 0; i < states_count; i++) {
+        MarkovNode *state = states[i].markov_node;
+        if (front_coded) {
+            fprintf(file, "S %d\n", i);
+        } else {
+            fprintf(file, "S %s\n", states[i].token);
+        }
+        for (int j = 0; j < state->counter_lst_size; j++) {
+            NextNodeCounter *counter = &state->counter_list[j];
+            edges[j] = (TokenEntry) {to_token(counter->markov_node->data),
+                                     counter->markov_node, counter->frequency,
+                                     0};
+            if (front_coded) {
+                edges[j].id = ids[counter->markov_node->index];
+            }
+        }
+        // the ids are in token order, so both sort the edges the same way
+        qsort(edges, state->counter_lst_size, sizeof(TokenEntry),
+              front_coded ? compare_token_ids : compare_token_entries);
+        for (int j = 0; j < state->counter_lst_size; j++) {
+            if (front_coded) {
+                fprintf(file, "E %d %d\n", edges[j].id, edges[j].frequency);
+            } else {
+                fprintf(file, "E %s %d\n", edges[j].token,
+                        edges[j].frequency);
+            }
+        }
+    }
+    free(edges);
+    free(states);
+    free(ids);
+    return !ferror(file);
+}
+
+
+/**
+ * Save markov_chain to file, sorted so it can be merged with other models.
+ * @param markov_chain the chain to save
+ * @param file file opened for writing
+ * @param to_token converts the data of a state to it's token
+ * @return true on success, false in case of allocation or write error
+ */
+bool save_markov_chain(MarkovChain *markov_chain, FILE *file,
+                       token_func to_token) {
+    return save_model(markov_chain, file, to_token, false);
+}
+
+
+/**
+ * Save markov_chain to file as a front-coded model, which writes every token
+ * once, sharing the prefixes of neighbouring tokens.
+ * @param markov_chain the chain to save
+ * @param file file opened for writing
+ * @param to_token converts the data of a state to it's token, different
+ *                 states must have different tokens
+ * @return true on success, false in case of allocation or write error
+ */
+bool save_front_coded_model(MarkovChain *markov_chain, FILE *file,
+                            token_func to_token) {
+    return save_model(markov_chain, file, to_token, true);
+}
+
+
+/**
+ * Read the header line of a saved model.
+ * @return the format of the model, FORMAT_NONE if file is not a saved model
+ */
+static ModelFormat read_header(FILE *file) {
+    char line[MODEL_LINE_LENGTH];
+    if (!fgets(line, MODEL_LINE_LENGTH, file)) {
+        return FORMAT_NONE;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line, MODEL_HEADER) == 0) {
+        return FORMAT_PLAIN;
+    }
+    if (strcmp(line, FRONT_CODED_MODEL_HEADER) == 0) {
+        return FORMAT_FRONT_CODED;
+    }
+    return FORMAT_NONE;
+}
+
+
+/**
+ * Check whether file is a saved model. The file is rewound afterwards.
+ * @param file file opened for reading
+ * @return true if file starts with the header of a model, false otherwise
+ */
+bool is_saved_model(FILE *file) {
+    bool result = read_header(file) != FORMAT_NONE;
+    rewind(file);
+    return result;
+}
+
+
+/**
+ * Read the tokens of a front-coded model into a new vocabulary, in which the
+ * id of every token is it's position in the model.
+ * @return the tokens, NULL in case of allocation or format error
+ */
+static Vocabulary *read_tokens(FILE *file) {
+    char line[MODEL_LINE_LENGTH];
+    char token[MODEL_TOKEN_LENGTH] = "";
+    long count;
+    if (!fgets(line, MODEL_LINE_LENGTH, file) ||
+        sscanf(line, "V %ld", &count) != 1 || count < 0) {
+        return NULL;
+    }
+    Vocabulary *tokens = create_vocabulary();
+    for (long i = 0; tokens && i < count; i++) {
+        char *shared = NULL, *rest = NULL;
+        if (fgets(line, MODEL_LINE_LENGTH, file)) {
+            shared = strtok(line, " \n\r");
+            rest = strtok(NULL, " \n\r");
+        }
+        size_t shared_length = shared ? strtoul(shared, NULL, DECIMAL_BASE)
+                                      : 0;
+        if (!rest || shared_length > strlen(token) ||
+            shared_length + strlen(rest) >= MODEL_TOKEN_LENGTH) {
+            free_vocabulary(&tokens);
+            break;
+        }
+        strcpy(token + shared_length, rest);
+        // the tokens are distinct, so each one gets the next id
+        if (intern_word(tokens, token) != i) {
+            free_vocabulary(&tokens);
+        }
+    }
+    return tokens;
+}
+
+
+/**
+ * Start reading a saved model: read it's header, and the tokens of a
+ * front-coded model.
+ * @return true on success, false in case of allocation or format error
+ */
+static bool open_reader(ModelReader *reader, FILE *file) {
+    reader->file = file;
+    reader->kind = RECORD_END;
+    reader->tokens = NULL;
+    ModelFormat format = read_header(file);
+    if (format == FORMAT_FRONT_CODED) {
+        reader->tokens = read_tokens(file);
+        return reader->tokens != NULL;
+    }
+    return format == FORMAT_PLAIN;
+}
+
+
+static void close_reader(ModelReader *reader) {
+    free_vocabulary(&reader->tokens);
+}
+
+
+/**
+ * Copy the token of a record to destination: the token itself in a plain
+ * model, the token of it's id in a front-coded one.
+ * @return true on success, false in case of an unknown id
+ */
+static bool read_token(const ModelReader *reader, const char *token,
+                       char *destination) {
+    if (!reader->tokens) {
+        strcpy(destination, token);
+        return true;
+    }
+    char *end;
+    long id = strtol(token, &end, DECIMAL_BASE);
+    if (*end != '\0' || id < 0 || id >= reader->tokens->words_count) {
+        return false;
+    }
+    strcpy(destination, word_of_id(reader->tokens, (int) id));
+    return true;
+}
+
+
+/**
+ * Read the next record of a saved model into reader. At the end of the file
+ * reader->kind is RECORD_END.
+ * @return true on success, false in case of a read or format error
+ */
+static bool read_record(ModelReader *reader) {
+    char line[MODEL_LINE_LENGTH];
+    if (!fgets(line, MODEL_LINE_LENGTH, reader->file)) {
+        reader->kind = RECORD_END;
+        return !ferror(reader->file);
+    }
+    char *kind = strtok(line, " \n\r");
+    char *token = strtok(NULL, " \n\r");
+    if (!kind || !token || strlen(token) >= MODEL_TOKEN_LENGTH) {
+        return false;
+    }
+    if (strcmp(kind, "S") == 0) {
+        reader->kind = RECORD_STATE;
+        reader->frequency = 0;
+        return read_token(reader, token, reader->state);
+    }
+    char *frequency = strtok(NULL, " \n\r");
+    if (strcmp(kind, "E") != 0 || reader->kind == RECORD_END || !frequency) {
+        return false; // an edge must follow a state
+    }
+    reader->kind = RECORD_EDGE;
+    if (!read_token(reader, token, reader->successor)) {
+        return false;
+    }
+    reader->frequency = strtol(frequency, NULL, DECIMAL_BASE);
+    return reader->frequency > 0;
+}
+
+
+/**
+ * Load a saved model into markov_chain. Frequencies are added to the ones
+ * already in the chain.
+ * @param markov_chain the chain to load into
+ * @param file file opened for reading
+ * @param to_data converts a token to the data of it's state
+ * @return true on success, false in case of allocation or format error
+ */
+bool load_markov_chain(MarkovChain *markov_chain, FILE *file,
+                       data_func to_data) {
+    if (!markov_chain || !file || !to_data) {
+        return false;
+    }
+    ModelReader *reader = malloc(sizeof(ModelReader));
+    if (!reader) {
+        return false;
+    }
+    if (!open_reader(reader, file)) {
+        close_reader(reader);
+        free(reader);
+        return false;
+    }
+    Node *state = NULL;
+    bool success;
+    while ((success = read_record(reader)) && reader->kind != RECORD_END) {
+        if (reader->kind == RECORD_STATE) {
+            void *data = to_data(reader->state);
+            state = data ? add_to_database(markov_chain, data) : NULL;
+            success = state != NULL;
+        } else {
+            void *data = to_data(reader->successor);
+            Node *successor = data ? add_to_database(markov_chain, data)
+                                   : NULL;
+            success = successor != NULL && reader->frequency <= INT_MAX &&
+                      add_frequency_to_counter_list(state->data,
+                                                    successor->data,
+                                                    markov_chain,
+                                                    (int) reader->frequency);
+        }
+        if (!success) {
+            break;
+        }
+    }
+    close_reader(reader);
+    free(reader);
+    return success;
+}
+
+
+/**
+ * Compare the current records of two readers by state, then states before
+ * edges, then by successor. Finished readers are bigger than any record.
+ */
+static int compare_records(const ModelReader *first,
+                           const ModelReader *second) {
+    if (first->kind == RECORD_END || second->kind == RECORD_END) {
+        return (first->kind == RECORD_END) - (second->kind == RECORD_END);
+    }
+    int result = strcmp(first->state, second->state);
+    if (result != 0) {
+        return result;
+    }
+    if (first->kind != second->kind) {
+        return first->kind == RECORD_STATE ? -1 : 1;
+    }
+    if (first->kind == RECORD_EDGE) {
+        return strcmp(first->successor, second->successor);
+    }
+    return 0;
+}
+
+
+/**
+ * Read the next record of a merged model, and check that it comes after the
+ * current one: the merge needs every model sorted, without repeated records.
+ * @param reader
+ * @param previous set to the current record
+ * @return true on success, false in case of a read or format error, or of a
+ * record out of order
+ */
+static bool read_sorted_record(ModelReader *reader, ModelReader *previous) {
+    *previous = *reader;
+    return read_record(reader) &&
+           (reader->kind == RECORD_END || compare_records(previous, reader) < 0);
+}
+
+
+/**
+ * Merge saved models into one: the states are the union of their states, and
+ * the frequency of every edge is the sum of it's frequencies. Reads every
+ * input once, a record at a time, so the memory used doesn't depend on the
+ * size of the models (but the tokens of front-coded inputs). The output is
+ * not front-coded.
+ * @param inputs files of saved models, opened for reading
+ * @param inputs_count number of inputs
+ * @param output file opened for writing
+ * @return true on success, false in case of an allocation, format or write
+ * error, or if a model is not sorted
+ */
+bool merge_models(FILE **inputs, int inputs_count, FILE *output) {
+    // readers that were not opened have no tokens to free
+    ModelReader *readers = calloc(inputs_count + 1, sizeof(ModelReader));
+    ModelReader *previous = malloc(sizeof(ModelReader));
+    bool *matched = malloc(sizeof(bool) * (inputs_count + 1));
+    bool success = readers && previous && matched;
+    for (int i = 0; success && i < inputs_count; i++) {
+        success = open_reader(&readers[i], inputs[i]) &&
+                  read_record(&readers[i]);
+    }
+    if (success) {
+        fprintf(output, "%s\n", MODEL_HEADER);
+    }
+    while (success) {
+        ModelReader *smallest = NULL;
+        for (int i = 0; i < inputs_count; i++) {
+            if (readers[i].kind != RECORD_END &&
+                (!smallest || compare_records(&readers[i], smallest) < 0)) {
+                smallest = &readers[i];
+            }
+        }
+        if (!smallest) {
+            break;
+        }
+        // every input has the record at most once, so sum over the inputs:
+        long frequency = 0;
+        for (int i = 0; i < inputs_count; i++) {
+            matched[i] = compare_records(&readers[i], smallest) == 0;
+            if (matched[i]) {
+                frequency += readers[i].frequency;
+            }
+        }
+        if (smallest->kind == RECORD_STATE) {
+            fprintf(output, "S %s\n", smallest->state);
+        } else {
+            fprintf(output, "E %s %ld\n", smallest->successor, frequency);
+        }
+        for (int i = 0; success && i < inputs_count; i++) {
+            if (matched[i]) {
+                success = read_sorted_record(&readers[i], previous);
+            }
+        }
+    }
+    for (int i = 0; readers && i < inputs_count; i++) {
+        close_reader(&readers[i]);
+    }
+    free(readers);
+    free(previous);
+    free(matched);
+    return success && !ferror(output);
+}
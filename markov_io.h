@@ -0,0 +1,96 @@
+#ifndef _MARKOV_IO_H
+#define _MARKOV_IO_H
+
+#include "markov_chain.h"
+
+/*
+ * A saved model is a text file of records, sorted by state and then by
+ * successor (byte order), so several models can be merged in one streaming
+ * pass:
+ *
+ *     markov-chain-v1
+ *     S <state>
+ *     E <successor> <frequency>     (edges of the state above)
+ *
+ * Every state of the chain has an S record, even if it has no successors.
+ * States are written as tokens with no whitespace in them.
+ *
+ * A front-coded model starts with it's sorted tokens instead, each one given
+ * by the length of the prefix it shares with the previous token and the rest
+ * of it, and the records refer to the tokens by their position in the list:
+ *
+ *     markov-chain-v1-fc
+ *     V <tokens count>
+ *     <shared prefix length> <rest of token>
+ *     S <token id>
+ *     E <token id> <frequency>
+ *
+ * Both formats are read everywhere a model is read.
+ */
+#define MODEL_HEADER "markov-chain-v1"
+#define FRONT_CODED_MODEL_HEADER "markov-chain-v1-fc"
+#define MODEL_TOKEN_LENGTH 1001
+
+// pointer to a func that receives data from a generic type and returns it's
+// token (a string with no whitespace) to be saved.
+typedef const char *(*token_func) (void *);
+
+// pointer to a func that receives a saved token and returns the data of it's
+// state, to be given to add_to_database. returns NULL on allocation failure.
+typedef void *(*data_func) (const char *);
+
+/**
+ * Save markov_chain to file, sorted so it can be merged with other models.
+ * @param markov_chain the chain to save
+ * @param file file opened for writing
+ * @param to_token converts the data of a state to it's token
+ * @return true on success, false in case of allocation or write error
+ */
+bool save_markov_chain(MarkovChain *markov_chain, FILE *file,
+                       token_func to_token);
+
+/**
+ * Save markov_chain to file as a front-coded model, which writes every token
+ * once, sharing the prefixes of neighbouring tokens.
+ * @param markov_chain the chain to save
+ * @param file file opened for writing
+ * @param to_token converts the data of a state to it's token, different
+ *                 states must have different tokens
+ * @return true on success, false in case of allocation or write error
+ */
+bool save_front_coded_model(MarkovChain *markov_chain, FILE *file,
+                            token_func to_token);
+
+/**
+ * Check whether file is a saved model. The file is rewound afterwards.
+ * @param file file opened for reading
+ * @return true if file starts with the header of a model, false otherwise
+ */
+bool is_saved_model(FILE *file);
+
+/**
+ * Load a saved model into markov_chain. Frequencies are added to the ones
+ * already in the chain.
+ * @param markov_chain the chain to load into
+ * @param file file opened for reading
+ * @param to_data converts a token to the data of it's state
+ * @return true on success, false in case of allocation or format error
+ */
+bool load_markov_chain(MarkovChain *markov_chain, FILE *file,
+                       data_func to_data);
+
+/**
+ * Merge saved models into one: the states are the union of their states, and
+ * the frequency of every edge is the sum of it's frequencies. Reads every
+ * input once, a record at a time, so the memory used doesn't depend on the
+ * size of the models (but the tokens of front-coded inputs). The output is
+ * not front-coded.
+ * @param inputs files of saved models, opened for reading
+ * @param inputs_count number of inputs
+ * @param output file opened for writing
+ * @return true on success, false in case of an allocation, format or write
+ * error, or if a model is not sorted (or repeats a record)
+ */
+bool merge_models(FILE **inputs, int inputs_count, FILE *output);
+
+#endif /* _MARKOV_IO_H */
@@ -0,0 +1,145 @@
+#include "sketch_training.h"
+#include <limits.h> // For INT_MAX
+
+
+/**
+ * Create a count-min sketch of SKETCH_DEPTH rows that fits in memory_budget
+ * bytes.
+ * @param memory_budget size of the counters in bytes
+ * @return newly allocated sketch, NULL in case of allocation failure or a
+ * budget too small for a single counter per row.
+ */
+CountMinSketch *create_count_min_sketch(size_t memory_budget) {
+    size_t width = memory_budget / (sizeof(uint32_t) * SKETCH_DEPTH);
+    if (width == 0 || width > INT32_MAX) {
+        return NULL;
+    }
+    CountMinSketch *sketch = malloc(sizeof(CountMinSketch));
+    if (!sketch) {
+        return NULL;
+    }
+    sketch->width = (int) width;
+    sketch->depth = SKETCH_DEPTH;
+    sketch->counters = calloc(width * SKETCH_DEPTH, sizeof(uint32_t));
+    if (!sketch->counters) {
+        free(sketch);
+        return NULL;
+    }
+    return sketch;
+}
+
+
+/**
+ * Free sketch and all of it's content from memory.
+ * @param sketch sketch to free
+ */
+void free_count_min_sketch(CountMinSketch **ptr_sketch) {
+    CountMinSketch *sketch = *ptr_sketch;
+    if (!sketch) {
+        return;
+    }
+    free(sketch->counters);
+    free(sketch);
+    *ptr_sketch = NULL;
+}
+
+
+/**
+ * Index of key in the given row of the sketch (splitmix64 of the key mixed
+ * with the row).
+ */
+static size_t counter_index(CountMinSketch *sketch, int row, uint64_t key) {
+    uint64_t hash = key + (uint64_t) (row + 1) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return (size_t) row * sketch->width + (size_t) (hash % sketch->width);
+}
+
+
+/**
+ * Count one more occurrence of key (conservative update: only the smallest
+ * counters are incremented, so the estimate grows by exactly one).
+ * @param sketch
+ * @param key hash of the counted item
+ * @return the estimated count of key, including this occurrence
+ */
+uint32_t count_min_add(CountMinSketch *sketch, uint64_t key) {
+    uint32_t estimate = UINT32_MAX;
+    for (int row = 0; row < sketch->depth; row++) {
+        uint32_t counter = sketch->counters[counter_index(sketch, row, key)];
+        if (counter < estimate) {
+            estimate = counter;
+        }
+    }
+    if (estimate == UINT32_MAX) {
+        return estimate;
+    }
+    estimate++;
+    for (int row = 0; row < sketch->depth; row++) {
+        uint32_t *counter = &sketch->counters[counter_index(sketch, row, key)];
+        if (*counter < estimate) {
+            *counter = estimate;
+        }
+    }
+    return estimate;
+}
+
+
+/**
+ * Find the successor of state whose data is data.
+ * @return the successor, NULL if data doesn't follow state in the chain
+ */
+static MarkovNode *find_successor(MarkovChain *markov_chain,
+                                  const MarkovNode *state, void *data) {
+    for (int i = 0; i < state->counter_lst_size; i++) {
+        MarkovNode *successor = state->counter_list[i].markov_node;
+        if (markov_chain->comp_func(successor->data, data) == 0) {
+            return successor;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Count the pair (first_data, second_data): in the chain if it was added to
+ * it already, in the sketch otherwise. It is added to the chain once it's
+ * estimated count reaches min_count, with all the occurrences estimated so far
+ * (more than min_count if colliding pairs raised it's counters). The states
+ * are created only when the pair is added, so rare pairs take no memory in
+ * the chain.
+ * @param markov_chain
+ * @param sketch counts of the pairs not in the chain yet
+ * @param min_count estimated count a pair needs to be added to the chain
+ * @param first_data data of the first state
+ * @param second_data data of the second state
+ * @param pair_hash hash of the pair
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_pair_with_sketch(MarkovChain *markov_chain, CountMinSketch *sketch,
+                          int min_count, void *first_data, void *second_data,
+                          uint64_t pair_hash) {
+    Node *first_node = get_node_from_database(markov_chain, first_data);
+    MarkovNode *successor = first_node ?
+                            find_successor(markov_chain, first_node->data,
+                                           second_data) : NULL;
+    if (successor) {
+        // once admitted, the pair is counted in the chain itself
+        return add_node_to_counter_list(first_node->data, successor,
+                                        markov_chain);
+    }
+    uint32_t estimate = count_min_add(sketch, pair_hash);
+    if (estimate < (uint32_t) min_count) {
+        return true;
+    }
+    first_node = add_to_database(markov_chain, first_data);
+    Node *second_node = add_to_database(markov_chain, second_data);
+    if (!first_node || !second_node) {
+        return false;
+    }
+    int frequency = estimate > INT_MAX ? INT_MAX : (int) estimate;
+    return add_frequency_to_counter_list(first_node->data, second_node->data,
+                                         markov_chain, frequency);
+}
@@ -0,0 +1,64 @@
+#ifndef _SKETCH_TRAINING_H
+#define _SKETCH_TRAINING_H
+
+#include "markov_chain.h"
+#include <stdint.h> // For uint32_t, uint64_t
+
+#define SKETCH_DEPTH 4
+
+/**
+ * Count-min sketch: depth rows of width counters. A key is counted in one
+ * counter of every row, and it's estimate is the smallest of them, which is
+ * never less than it's real count.
+ */
+typedef struct CountMinSketch {
+    int width;
+    int depth;
+    uint32_t *counters;
+} CountMinSketch;
+
+/**
+ * Create a count-min sketch of SKETCH_DEPTH rows that fits in memory_budget
+ * bytes.
+ * @param memory_budget size of the counters in bytes
+ * @return newly allocated sketch, NULL in case of allocation failure or a
+ * budget too small for a single counter per row.
+ */
+CountMinSketch *create_count_min_sketch(size_t memory_budget);
+
+/**
+ * Free sketch and all of it's content from memory.
+ * @param sketch sketch to free
+ */
+void free_count_min_sketch(CountMinSketch **sketch);
+
+/**
+ * Count one more occurrence of key (conservative update: only the smallest
+ * counters are incremented, so the estimate grows by exactly one).
+ * @param sketch
+ * @param key hash of the counted item
+ * @return the estimated count of key, including this occurrence
+ */
+uint32_t count_min_add(CountMinSketch *sketch, uint64_t key);
+
+/**
+ * Count the pair (first_data, second_data): in the chain if it was added to
+ * it already, in the sketch otherwise. It is added to the chain once it's
+ * estimated count reaches min_count, with all the occurrences estimated so far
+ * (more than min_count if colliding pairs raised it's counters). The states
+ * are created only when the pair is added, so rare pairs take no memory in
+ * the chain.
+ * @param markov_chain
+ * @param sketch counts of the pairs not in the chain yet
+ * @param min_count estimated count a pair needs to be added to the chain
+ * @param first_data data of the first state
+ * @param second_data data of the second state
+ * @param pair_hash hash of the pair
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_pair_with_sketch(MarkovChain *markov_chain, CountMinSketch *sketch,
+                          int min_count, void *first_data, void *second_data,
+                          uint64_t pair_hash);
+
+#endif /* _SKETCH_TRAINING_H */
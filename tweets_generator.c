@@ -2,9 +2,64 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h> // For INT_MAX
+#include <float.h> // For DBL_MIN, DBL_MAX
 #include "markov_chain.h"
+#include "constrained_generation.h"
+#include "beam_search.h"
+#include "markov_io.h"
+#include "external_training.h"
+#include "sketch_training.h"
+#include "vocabulary.h"
+#include "copy_filter.h"
 
 #define PARAMETERS_COUNT_MSG "Usage: The should be 3 or 4 variables."
+#define OPTIONS_MSG "Usage: options are --contain <word>, --end-with <word>, \
+--top-k <k>, --top-p <p>, --temperature <t>, --start <word>, --beam <n> and \
+--threads <n>, --save <model>, --save-front-coded <model>, \
+--sketch-memory <bytes>, --min-count <n>, --prune <n>, \
+--copy-filter <false positive rate>, --copy-filter-memory <bytes> and \
+--copy-ngrams <n>. --top-k, --beam, --prune and --copy-ngrams take a whole \
+number >= 0, --threads and --min-count one >= 1, --top-p a number in (0, 1], --temperature \
+one >= 0 and --copy-filter one in (0, 1)."
+#define TWEETS_COUNT_MSG "Usage: the number of tweets must be a whole number \
+>= 0."
+#define OPTION_VALUE_MSG "Usage: invalid value %s for %s.\n"
+#define MERGE_USAGE_MSG "Usage: merge <output model> <model> [<model> ...]"
+#define TRAIN_USAGE_MSG "Usage: train <text file> <output model> \
+<memory budget in bytes> [words to read]"
+#define MEMORY_BUDGET_MSG "Usage: the memory budget must be a whole number \
+of at least %d bytes.\n"
+#define TRAINING_ERROR "Error: Training failed, cannot read or write the \
+files, or allocate memory."
+#define NO_FIRST_WORD_ERROR "Error: No word of the chain can start a tweet, \
+train on more words or lower --prune and --min-count."
+#define MODEL_FORMAT_ERROR "Error: Cannot read the model, check its format."
+#define MODEL_SAVE_ERROR "Error: Cannot save the model."
+#define TARGET_WORD_ERROR "Error: The target word is not in the database."
+#define START_WORD_ERROR "Error: The start word is not in the database."
+#define TARGET_UNREACHABLE_ERROR "Error: No tweet can reach the target word."
+#define CONSTRAINT_OPTIONS_ERROR "Error: --contain and --end-with sample by \
+frequency among the words that reach the target, they can't be used with \
+--top-k, --top-p or --temperature."
+#define MIN_COUNT_MSG "Usage: --min-count is the count a pair needs in the \
+sketch, it can only be used with --sketch-memory."
+#define BEAM_OPTIONS_ERROR "Error: --beam finds the most probable tweets, it \
+can't be used with --contain, --end-with, --top-k, --top-p or --temperature."
+#define COPY_FILTER_MODEL_ERROR "Error: The copy filter is built from a text \
+file, not from a saved model."
+#define COPY_FILTER_ERROR "Error: The copy filter needs a false positive rate \
+in (0, 1) or a memory size, and n-grams of 3 to 32 words (every pair of words \
+in a generated tweet is in the training text, so shorter n-grams reject every \
+tweet)."
+#define COPY_FILTER_REPORT "Copy filter: %lu bytes, %ld lines (estimated false \
+positive rate %.4f%%)"
+#define COPY_FILTER_NGRAMS_REPORT ", %ld %d-grams (estimated false positive \
+rate %.4f%%)"
+#define COPY_FILTER_REJECTED "Copy filter: rejected %ld generated tweets.\n"
+#define ORIGINAL_TWEET_ERROR "Error: Tweet %d: every generated tweet was a \
+copy.\n"
 #define FILE_PATH_ERROR "Error: Cannot open file, check file path."
 #define MARKOV_CHAIN_ALLOCATION_FAILURE "Allocation failure: markov chain"
 #define DATABASE_ALLOCATION_FAILURE "Allocation failure: database"
@@ -16,6 +71,34 @@
 
 #define NO_INPUT -1
 #define TWEET_START_SIZE 20
+#define DEFAULT_MIN_COUNT 2
+#define MAX_COPY_ATTEMPTS 100
+#define DEFAULT_COPY_FILTER_RATE 0.01
+#define PERCENT 100
+
+/**
+ * Optional flags given after the positional arguments.
+ */
+typedef struct TweetOptions {
+    char *target_word; // NULL if the tweets are not constrained
+    ConstraintMode constraint_mode;
+    GenerationParams params;
+    char *start_word; // NULL to start every tweet with a random word
+    int beam_results; // print the n most probable tweets, 0 to sample them
+    int threads_count;
+    char *save_path; // where to save the trained chain, NULL to not save it
+    bool front_coded; // save the chain as a front-coded model
+    size_t sketch_memory; // train approximately with a count-min sketch of
+                          // this size, 0 to count every pair exactly
+    int min_count; // estimated count a pair needs to enter the chain,
+                   // NO_INPUT for DEFAULT_MIN_COUNT
+    int prune_frequency; // drop pairs less frequent than this after training
+    double copy_filter_rate; // regenerate tweets that copy a training line,
+                             // with this false positive rate, 0 to not check
+    size_t copy_filter_memory; // size the copy filter by memory instead
+    int copy_ngram_length; // also regenerate tweets that copy this many
+                           // consecutive words, 0 to check only whole lines
+} TweetOptions;
 
 int count_markov_chain(MarkovChain *markov_chain){
   Node *current_node = markov_chain->database->first;
@@ -37,40 +120,38 @@ FILE *open_file(char *path) {
     return file;
 }
 
+/* The words of the chain, every word is kept once. The data of a state is
+ * the id of it's word (see WORD_ID_TO_DATA). */
+static Vocabulary *vocabulary = NULL;
+
 int compare_words (void *data_1, void *data_2)
 {
-    const char *word_1 = (const char *) data_1;
-    const char *word_2 = (const char *) data_2;
-    return strcmp (word_1, word_2);
+    return DATA_TO_WORD_ID(data_1) - DATA_TO_WORD_ID(data_2);
 }
 
 void print_word (void *data)
 {
-    const char *word = (const char *) data;
-    printf("%s ", word);
+    printf("%s ", word_of_id(vocabulary, DATA_TO_WORD_ID(data)));
 }
 
 void* copy_word (void *data)
 {
-    const char *word = (const char *) data;
-    char *new_allocated_word = calloc(sizeof(char), strlen(word) + 1);
-    if(new_allocated_word)
-    {
-        strcpy(new_allocated_word, word);
-        return (void *) new_allocated_word;
-    }
-    return NULL;
+    return data; // the word itself is in the vocabulary
 }
 
 void free_word (void* data)
 {
-    char* word = (char *) data;
-    free(word);
+    (void) data;
+}
+
+const char *word_token (void *data)
+{
+    return word_of_id(vocabulary, DATA_TO_WORD_ID(data));
 }
 
 bool is_last_word (void *data)
 {
-    const char* word = (const char *) data;
+    const char* word = word_of_id(vocabulary, DATA_TO_WORD_ID(data));
     if(strcmp(&word[strlen(word) - 1], ".") == 0){
         return true;
     }
@@ -79,7 +160,40 @@ bool is_last_word (void *data)
     }
 }
 
-int fill_database (FILE *fp, int words_to_read, MarkovChain *markov_chain){
+/**
+ * Get the data of word, adding it to the vocabulary if needed.
+ * @return the data, NULL in case of allocation failure
+ */
+void *word_data (const char *word)
+{
+    int id = intern_word(vocabulary, word);
+    return id < 0 ? NULL : WORD_ID_TO_DATA(id);
+}
+
+/**
+ * Find the state of word in markov_chain.
+ * @return the state, NULL if word is not in the chain
+ */
+Node *find_word_node (MarkovChain *markov_chain, const char *word)
+{
+    int id = find_word(vocabulary, word);
+    if (id < 0) {
+        return NULL;
+    }
+    return get_node_from_database(markov_chain, WORD_ID_TO_DATA(id));
+}
+
+/**
+ * Train markov_chain on the words of the text file, and add every line to
+ * copy_filter.
+ * @param fp text file
+ * @param words_to_read number of words to read, NO_INPUT to read them all
+ * @param markov_chain
+ * @param copy_filter filter of the training lines, NULL to not keep them
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int fill_database (FILE *fp, int words_to_read, MarkovChain *markov_chain,
+                   CopyFilter *copy_filter){
     //read file:
     char line[LINE_LENGTH] = {0};
     int counter = 0;
@@ -87,16 +201,20 @@ int fill_database (FILE *fp, int words_to_read, MarkovChain *markov_chain){
         return EXIT_SUCCESS;
     }
     char *word;
+    SequenceHasher hasher;
     while(fgets(line, LINE_LENGTH, fp)) {
         Node *prev = NULL;
         Node *current_node = NULL;
+        start_sequence_hash(&hasher);
 
         word = (char*)strtok(line, " \n\r");
         while (word != NULL) {
             if(strcmp(word, "\n") == 0){
               break;
             }
-            if (!(current_node = add_to_database(markov_chain, word))) {
+            void *data = word_data(word);
+            if (!data ||
+                !(current_node = add_to_database(markov_chain, data))) {
                 return EXIT_FAILURE;
             }
 
@@ -104,32 +222,707 @@ int fill_database (FILE *fp, int words_to_read, MarkovChain *markov_chain){
                 add_node_to_counter_list(prev->data, current_node->data, markov_chain);
             }
             prev = current_node;
+            if (copy_filter) {
+                add_training_word(copy_filter, &hasher,
+                                  (uint64_t) DATA_TO_WORD_ID(data));
+            }
 
             word = (char*)strtok(NULL, " \n\r");
             counter ++;
             if(counter == words_to_read && words_to_read != NO_INPUT){
-                return EXIT_SUCCESS;
+                break;
+            }
+        }
+        if (copy_filter) {
+            add_training_line(copy_filter, &hasher);
+        }
+        if(counter == words_to_read && words_to_read != NO_INPUT){
+            return EXIT_SUCCESS;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+ * Parse the whole text as a decimal integer of at least min_value.
+ * @param text
+ * @param min_value smallest accepted number
+ * @param value set to the number on success
+ * @return true on success, false if text is not such a number
+ */
+bool parse_int_option(const char *text, int min_value, int *value) {
+    char *end;
+    errno = 0;
+    long number = strtol(text, &end, DECIMAL_BASE);
+    if (end == text || *end != '\0' || errno == ERANGE ||
+        number < min_value || number > INT_MAX) {
+        return false;
+    }
+    *value = (int) number;
+    return true;
+}
+
+/**
+ * Parse the whole text as a decimal number of bytes.
+ * @param text
+ * @param value set to the number on success
+ * @return true on success, false if text is not such a number
+ */
+bool parse_size_option(const char *text, size_t *value) {
+    char *end;
+    if (*text < '0' || *text > '9') {
+        return false; // strtoul accepts a sign, and negates the number
+    }
+    errno = 0;
+    unsigned long number = strtoul(text, &end, DECIMAL_BASE);
+    if (*end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    *value = (size_t) number;
+    return true;
+}
+
+/**
+ * Parse the whole text as a number in [min_value, max_value].
+ * @param text
+ * @param min_value smallest accepted number, DBL_MIN to accept only positive
+ *                  numbers
+ * @param max_value biggest accepted number
+ * @param value set to the number on success
+ * @return true on success, false if text is not such a number
+ */
+bool parse_double_option(const char *text, double min_value, double max_value,
+                         double *value) {
+    char *end;
+    errno = 0;
+    double number = strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE ||
+        !(number >= min_value && number <= max_value)) {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+/**
+ * Parse the flags that follow the positional arguments.
+ * @param argc
+ * @param argv
+ * @param first index of the first flag in argv
+ * @param options options to fill
+ * @return EXIT_SUCCESS or EXIT_FAILURE on an unknown or incomplete flag, or
+ * on a value out of it's range
+ */
+int parse_options(int argc, char *argv[], int first, TweetOptions *options) {
+    *options = (TweetOptions) {NULL, CONSTRAINT_CONTAIN,
+                               default_generation_params(SEQUENCE_MAX_LENGTH),
+                               NULL, 0, 1, NULL, false, 0, NO_INPUT,
+                               0, 0, 0, 0};
+    for (int i = first; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            return EXIT_FAILURE;
+        }
+        char *value = argv[i + 1];
+        bool valid = true;
+        if (strcmp(argv[i], "--contain") == 0) {
+            options->target_word = value;
+            options->constraint_mode = CONSTRAINT_CONTAIN;
+        } else if (strcmp(argv[i], "--end-with") == 0) {
+            options->target_word = value;
+            options->constraint_mode = CONSTRAINT_END_WITH;
+        } else if (strcmp(argv[i], "--top-k") == 0) {
+            valid = parse_int_option(value, 0, &options->params.top_k);
+        } else if (strcmp(argv[i], "--top-p") == 0) {
+            valid = parse_double_option(value, DBL_MIN, 1,
+                                        &options->params.top_p);
+        } else if (strcmp(argv[i], "--temperature") == 0) {
+            valid = parse_double_option(value, 0, DBL_MAX,
+                                        &options->params.temperature);
+        } else if (strcmp(argv[i], "--start") == 0) {
+            options->start_word = value;
+        } else if (strcmp(argv[i], "--beam") == 0) {
+            valid = parse_int_option(value, 0, &options->beam_results);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            valid = parse_int_option(value, 1, &options->threads_count);
+        } else if (strcmp(argv[i], "--save") == 0) {
+            options->save_path = value;
+            options->front_coded = false;
+        } else if (strcmp(argv[i], "--save-front-coded") == 0) {
+            options->save_path = value;
+            options->front_coded = true;
+        } else if (strcmp(argv[i], "--sketch-memory") == 0) {
+            valid = parse_size_option(value, &options->sketch_memory);
+        } else if (strcmp(argv[i], "--min-count") == 0) {
+            valid = parse_int_option(value, 1, &options->min_count);
+        } else if (strcmp(argv[i], "--prune") == 0) {
+            valid = parse_int_option(value, 0, &options->prune_frequency);
+        } else if (strcmp(argv[i], "--copy-filter") == 0) {
+            valid = parse_double_option(value, DBL_MIN, 1,
+                                        &options->copy_filter_rate);
+        } else if (strcmp(argv[i], "--copy-filter-memory") == 0) {
+            valid = parse_size_option(value, &options->copy_filter_memory);
+        } else if (strcmp(argv[i], "--copy-ngrams") == 0) {
+            valid = parse_int_option(value, 0, &options->copy_ngram_length);
+        } else {
+            return EXIT_FAILURE;
+        }
+        if (!valid) {
+            fprintf(stdout, OPTION_VALUE_MSG, value, argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    // --copy-ngrams alone checks the tweets with the default rate
+    if (options->copy_ngram_length != 0 && options->copy_filter_rate == 0 &&
+        options->copy_filter_memory == 0) {
+        options->copy_filter_rate = DEFAULT_COPY_FILTER_RATE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Check whether the options change the sampling: --top-k, --top-p or
+ * --temperature.
+ * @param options
+ * @return true if a sampling control was given
+ */
+bool has_sampling_controls(const TweetOptions *options) {
+    GenerationParams defaults = default_generation_params(SEQUENCE_MAX_LENGTH);
+    return options->params.top_k != defaults.top_k ||
+           options->params.top_p != defaults.top_p ||
+           options->params.temperature != defaults.temperature;
+}
+
+/**
+ * Check that the options don't combine beam search with a constraint or with
+ * sampling controls, which beam search doesn't use.
+ * @param options
+ * @return true if the options can be used together
+ */
+bool are_beam_options_valid(const TweetOptions *options) {
+    return options->beam_results <= 0 ||
+           (!options->target_word && !has_sampling_controls(options));
+}
+
+/**
+ * Print the beam_results most probable tweets from tweets_num first words,
+ * searched in parallel.
+ * @param markov_chain
+ * @param tweets_num number of first words to search from
+ * @param start first word of all the tweets, NULL for random first words
+ * @param options
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int create_beam_tweets(MarkovChain *markov_chain, long tweets_num,
+                       MarkovNode *start, TweetOptions *options) {
+    if (tweets_num <= 0) {
+        return EXIT_SUCCESS;
+    }
+    if (start) {
+        tweets_num = 1; // the same search would be repeated
+    }
+    BeamSearch **beam_searches = calloc(tweets_num, sizeof(BeamSearch *));
+    MarkovNode **first_nodes = malloc(sizeof(MarkovNode *) * tweets_num);
+    bool success = beam_searches && first_nodes;
+    for (long i = 0; success && i < tweets_num; i++) {
+        first_nodes[i] = start ? start : get_first_random_node(markov_chain);
+        beam_searches[i] = create_beam_search(options->beam_results,
+                                              options->params.max_length,
+                                              options->beam_results);
+        success = beam_searches[i] != NULL;
+    }
+    if (success) {
+        success = beam_search_many(beam_searches, markov_chain, first_nodes,
+                                   (int) tweets_num, options->threads_count);
+    }
+    for (long i = 0; success && i < tweets_num; i++) {
+        BeamSearch *beam_search = beam_searches[i];
+        for (int j = 0; j < beam_search->results_count; j++) {
+            fprintf(stdout, "Tweet %ld.%d (log p = %.2f): ", i + 1, j + 1,
+                    beam_search->results[j].log_prob);
+            print_hypothesis(markov_chain, &beam_search->results[j]);
+            fprintf(stdout, "\n");
+        }
+    }
+    for (long i = 0; beam_searches && i < tweets_num; i++) {
+        free_beam_search(&beam_searches[i]);
+    }
+    free(beam_searches);
+    free(first_nodes);
+    if (!success) {
+        fprintf(stdout, ALLOCATION_ERROR_MASSAGE);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Generate a tweet that is not a copy of a training line, and has no copied
+ * n-gram, and print it. A copy is generated again, with another seed; every
+ * word is checked as it's generated, so each attempt is O(length).
+ * @param markov_chain
+ * @param start first word of the tweet, NULL for a random first word
+ * @param options
+ * @param copy_filter filter of the training lines
+ * @param sequence room for options->params.max_length states
+ * @param rejected_count increased by the number of copies generated
+ * @return true if a tweet was printed, false if every attempt was a copy
+ */
+bool generate_original_tweet(MarkovChain *markov_chain, MarkovNode *start,
+                             TweetOptions *options,
+                             const CopyFilter *copy_filter,
+                             MarkovNode **sequence, long *rejected_count) {
+    SequenceGenerator generator;
+    SequenceHasher hasher;
+    for (int attempt = 0; attempt < MAX_COPY_ATTEMPTS; attempt++) {
+        init_sequence_generator(&generator, markov_chain, start,
+                                &options->params, (unsigned int) rand());
+        start_sequence_hash(&hasher);
+        int length = 0;
+        bool copied = false;
+        MarkovNode *node;
+        while (!copied && (node = next_sequence_node(&generator)) != NULL) {
+            sequence[length++] = node;
+            copied = is_copied_word(copy_filter, &hasher,
+                                    (uint64_t) DATA_TO_WORD_ID(node->data));
+        }
+        if (!copied && !is_copied_line(copy_filter, &hasher)) {
+            for (int i = 0; i < length; i++) {
+                markov_chain->print_func(sequence[i]->data);
+            }
+            return true;
+        }
+        (*rejected_count)++;
+    }
+    return false;
+}
+
+/**
+ * Generate and print tweets_num tweets out of the trained markov_chain.
+ * @param markov_chain
+ * @param tweets_num number of tweets to generate
+ * @param options
+ * @param copy_filter filter of the training lines, sampled tweets that copy
+ *                    them are generated again; NULL to not check them
+ * @return EXIT_SUCCESS or EXIT_FAILURE, also if a tweet had only copies (the
+ * other tweets are still printed)
+ */
+int create_tweets(MarkovChain *markov_chain, long tweets_num,
+                  TweetOptions *options, const CopyFilter *copy_filter) {
+    MarkovNode *start = NULL;
+    if (options->start_word) {
+        Node *start_node = find_word_node(markov_chain, options->start_word);
+        if (!start_node) {
+            fprintf(stdout, START_WORD_ERROR);
+            return EXIT_FAILURE;
+        }
+        start = start_node->data;
+    }
+    if (options->beam_results > 0) {
+        return create_beam_tweets(markov_chain, tweets_num, start, options);
+    }
+
+    ReverseIndex *reverse_index = NULL;
+    Reachability *reachability = NULL;
+    if (options->target_word) {
+        Node *target = find_word_node(markov_chain, options->target_word);
+        if (!target) {
+            fprintf(stdout, TARGET_WORD_ERROR);
+            return EXIT_FAILURE;
+        }
+        reverse_index = create_reverse_index(markov_chain);
+        reachability = create_reachability(reverse_index, target->data);
+        if (!reachability) {
+            free_reverse_index(&reverse_index);
+            fprintf(stdout, ALLOCATION_ERROR_MASSAGE);
+            return EXIT_FAILURE;
+        }
+        if (!can_reach_target(reachability, options->params.max_length) ||
+            (start && !can_reach_target_from(reachability, start,
+                                             options->params.max_length))) {
+            free_reachability(&reachability);
+            free_reverse_index(&reverse_index);
+            fprintf(stdout, TARGET_UNREACHABLE_ERROR);
+            return EXIT_FAILURE;
+        }
+    }
+
+    MarkovNode **sequence = NULL;
+    long rejected_count = 0;
+    int result = EXIT_SUCCESS;
+    if (copy_filter && !reachability) {
+        int max_length = options->params.max_length;
+        sequence = malloc(sizeof(MarkovNode *) * (max_length > 0 ?
+                                                  max_length : 1));
+        if (!sequence) {
+            fprintf(stdout, ALLOCATION_ERROR_MASSAGE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int count = 1;
+    while(count <= tweets_num)
+    {
+      fprintf(stdout, "Tweet %d: ",count);
+      if (reachability) {
+          generate_constrained_sequence(markov_chain, reachability, start,
+                                        options->params.max_length,
+                                        options->constraint_mode);
+      } else if (sequence) {
+          if (!generate_original_tweet(markov_chain, start, options,
+                                       copy_filter, sequence,
+                                       &rejected_count)) {
+              fprintf(stderr, ORIGINAL_TWEET_ERROR, count);
+              result = EXIT_FAILURE;
+          }
+      } else {
+          MarkovNode *first_node = start;
+          if (!first_node) {
+              first_node = get_first_random_node (markov_chain);
+          }
+          generate_sequence (markov_chain, first_node, &options->params);
+      }
+      fprintf(stdout, "\n");
+      count ++;
+    }
+    if (sequence) {
+        fprintf(stdout, COPY_FILTER_REJECTED, rejected_count);
+        free(sequence);
+    }
+    free_reachability(&reachability);
+    free_reverse_index(&reverse_index);
+    return result;
+}
+
+
+/**
+ * Merge saved models: merge <output model> <model> [<model> ...]
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int merge_files(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stdout, MERGE_USAGE_MSG);
+        return EXIT_FAILURE;
+    }
+    int inputs_count = argc - 3;
+    FILE **inputs = calloc(inputs_count, sizeof(FILE *));
+    if (!inputs) {
+        fprintf(stdout, ALLOCATION_ERROR_MASSAGE);
+        return EXIT_FAILURE;
+    }
+    int result = EXIT_SUCCESS;
+    for (int i = 0; i < inputs_count && result == EXIT_SUCCESS; i++) {
+        if (!(inputs[i] = open_file(argv[i + 3]))) {
+            fprintf(stdout, FILE_PATH_ERROR);
+            result = EXIT_FAILURE;
+        }
+    }
+    FILE *output = NULL;
+    if (result == EXIT_SUCCESS && !(output = fopen(argv[2], "w"))) {
+        fprintf(stdout, FILE_PATH_ERROR);
+        result = EXIT_FAILURE;
+    }
+    if (result == EXIT_SUCCESS && !merge_models(inputs, inputs_count, output)) {
+        fprintf(stdout, MODEL_FORMAT_ERROR);
+        result = EXIT_FAILURE;
+    }
+    if (output && fclose(output) != 0 && result == EXIT_SUCCESS) {
+        fprintf(stdout, MODEL_SAVE_ERROR);
+        result = EXIT_FAILURE;
+    }
+    for (int i = 0; i < inputs_count; i++) {
+        if (inputs[i]) {
+            fclose(inputs[i]);
+        }
+    }
+    free(inputs);
+    return result;
+}
+
+/**
+ * Train a model without keeping the chain in memory:
+ * train <text file> <output model> <memory budget in bytes> [words to read]
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int train_file(int argc, char *argv[]) {
+    if (argc < 5 || argc > 6) {
+        fprintf(stdout, TRAIN_USAGE_MSG);
+        return EXIT_FAILURE;
+    }
+    size_t memory_budget;
+    if (!parse_size_option(argv[4], &memory_budget) ||
+        memory_budget < MIN_MEMORY_BUDGET) {
+        fprintf(stdout, MEMORY_BUDGET_MSG, MIN_MEMORY_BUDGET);
+        return EXIT_FAILURE;
+    }
+    long words_to_read = NO_INPUT;
+    if (argc == 6) {
+        words_to_read = strtol(argv[5], NULL, DECIMAL_BASE);
+    }
+    FILE *corpus = open_file(argv[2]);
+    if (!corpus) {
+        fprintf(stdout, FILE_PATH_ERROR);
+        return EXIT_FAILURE;
+    }
+    FILE *output = fopen(argv[3], "w");
+    if (!output) {
+        fclose(corpus);
+        fprintf(stdout, FILE_PATH_ERROR);
+        return EXIT_FAILURE;
+    }
+    bool success = train_external(corpus, words_to_read, memory_budget, output,
+                                  NULL);
+    fclose(corpus);
+    if (fclose(output) != 0 || !success) {
+        fprintf(stdout, TRAINING_ERROR);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Save the trained markov_chain to the given path.
+ * @param front_coded save it as a front-coded model
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int save_model(MarkovChain *markov_chain, char *path, bool front_coded) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stdout, FILE_PATH_ERROR);
+        return EXIT_FAILURE;
+    }
+    bool success = front_coded ?
+                   save_front_coded_model(markov_chain, file, &word_token) :
+                   save_markov_chain(markov_chain, file, &word_token);
+    if (fclose(file) != 0 || !success) {
+        fprintf(stdout, MODEL_SAVE_ERROR);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+ * Key of a pair of words in the sketch: both word ids, so no two pairs share
+ * it. The sketch mixes the key itself.
+ */
+uint64_t hash_word_pair (void *first_data, void *second_data)
+{
+    return (uint64_t) DATA_TO_WORD_ID(first_data) << 32 |
+           (uint32_t) DATA_TO_WORD_ID(second_data);
+}
+
+/**
+ * Same as fill_database, but a pair of words enters the chain only once it
+ * was seen min_count times, counted approximately in sketch.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int fill_database_with_sketch (FILE *fp, int words_to_read,
+                               MarkovChain *markov_chain,
+                               CountMinSketch *sketch, int min_count,
+                               CopyFilter *copy_filter)
+{
+    char line[LINE_LENGTH] = {0};
+    int counter = 0;
+    SequenceHasher hasher;
+    while (counter != words_to_read && fgets(line, LINE_LENGTH, fp)) {
+        void *prev_data = NULL;
+        start_sequence_hash(&hasher);
+        for (char *word = strtok(line, " \n\r");
+             word != NULL && counter != words_to_read;
+             word = strtok(NULL, " \n\r")) {
+            void *data = word_data(word);
+            if (!data) {
+                return EXIT_FAILURE;
+            }
+            if (prev_data &&
+                !add_pair_with_sketch(markov_chain, sketch, min_count,
+                                      prev_data, data,
+                                      hash_word_pair(prev_data, data))) {
+                return EXIT_FAILURE;
             }
+            if (copy_filter) {
+                add_training_word(copy_filter, &hasher,
+                                  (uint64_t) DATA_TO_WORD_ID(data));
+            }
+            prev_data = data;
+            counter++;
+        }
+        if (copy_filter) {
+            add_training_line(copy_filter, &hasher);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Count the lines and words the training would read from fp, and rewind it.
+ * @param fp text file
+ * @param words_to_read number of words to read, NO_INPUT to read them all
+ * @param lines_count set to the number of lines
+ * @param words_count set to the number of words
+ */
+void count_training_text (FILE *fp, int words_to_read, long *lines_count,
+                          long *words_count)
+{
+    char line[LINE_LENGTH] = {0};
+    *lines_count = 0;
+    *words_count = 0;
+    while (*words_count != words_to_read && fgets(line, LINE_LENGTH, fp)) {
+        (*lines_count)++;
+        for (char *word = strtok(line, " \n\r");
+             word != NULL && *words_count != words_to_read;
+             word = strtok(NULL, " \n\r")) {
+            (*words_count)++;
         }
     }
+    rewind(fp);
+}
+
+/**
+ * Create the copy filter the options ask for, sized for the text in fp.
+ * @param fp text file
+ * @param words_to_read number of words to read, NO_INPUT to read them all
+ * @param options
+ * @param copy_filter set to the filter, NULL if the options don't ask for one
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int create_tweets_copy_filter (FILE *fp, int words_to_read,
+                               TweetOptions *options, CopyFilter **copy_filter)
+{
+    *copy_filter = NULL;
+    if (options->copy_filter_rate == 0 && options->copy_filter_memory == 0) {
+        return EXIT_SUCCESS;
+    }
+    long lines_count, words_count;
+    count_training_text(fp, words_to_read, &lines_count, &words_count);
+    *copy_filter = create_copy_filter(lines_count, words_count,
+                                      options->copy_ngram_length,
+                                      options->copy_filter_rate,
+                                      options->copy_filter_memory);
+    if (!*copy_filter) {
+        fprintf(stdout, COPY_FILTER_ERROR);
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
 
+/**
+ * Print the size and estimated false positive rates of copy_filter.
+ * @param copy_filter
+ */
+void print_copy_filter (const CopyFilter *copy_filter)
+{
+    const BloomFilter *lines = copy_filter->lines;
+    fprintf(stdout, COPY_FILTER_REPORT,
+            (unsigned long) copy_filter_memory(copy_filter), lines->items_count,
+            PERCENT * bloom_filter_error_rate(lines));
+    if (copy_filter->ngrams) {
+        fprintf(stdout, COPY_FILTER_NGRAMS_REPORT,
+                copy_filter->ngrams->items_count, copy_filter->ngram_length,
+                PERCENT * bloom_filter_error_rate(copy_filter->ngrams));
+    }
+    fprintf(stdout, ".\n");
+}
+
+/**
+ * Train markov_chain on the text file, as the options say.
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int train_chain (FILE *fp, int words_to_read, MarkovChain *markov_chain,
+                 TweetOptions *options, CopyFilter *copy_filter)
+{
+    int result;
+    if (options->sketch_memory > 0) {
+        CountMinSketch *sketch = create_count_min_sketch(
+                options->sketch_memory);
+        if (!sketch) {
+            fprintf(stdout, ALLOCATION_ERROR_MASSAGE);
+            return EXIT_FAILURE;
+        }
+        int min_count = options->min_count != NO_INPUT ? options->min_count
+                                                       : DEFAULT_MIN_COUNT;
+        result = fill_database_with_sketch(fp, words_to_read, markov_chain,
+                                           sketch, min_count, copy_filter);
+        free_count_min_sketch(&sketch);
+    } else {
+        result = fill_database(fp, words_to_read, markov_chain, copy_filter);
+    }
+    if (result == EXIT_SUCCESS && options->prune_frequency > 1 &&
+        !prune_markov_chain(markov_chain, options->prune_frequency)) {
+        fprintf(stdout, ALLOCATION_ERROR_MASSAGE);
+        return EXIT_FAILURE;
+    }
+    if (result == EXIT_SUCCESS && !has_first_node(markov_chain)) {
+        fprintf(stdout, NO_FIRST_WORD_ERROR);
+        return EXIT_FAILURE;
+    }
+    return result;
+}
+
+
+/**
+ * Free markov_chain and the vocabulary of it's words.
+ * @param markov_chain markov_chain to free
+ */
+void free_tweets_chain (MarkovChain **markov_chain)
+{
+    free_markov_chain(markov_chain);
+    free_vocabulary(&vocabulary);
+}
+
 
 int main(int argc, char *argv[]) {
-    if (argc < LOWER_ARGC_LIMIT || argc > UPPER_ARGC_LIMIT) {
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        return merge_files(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "train") == 0) {
+        return train_file(argc, argv);
+    }
+    // positional arguments come first, flags start with "--":
+    int positional_count = argc;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            positional_count = i;
+            break;
+        }
+    }
+    if (positional_count < LOWER_ARGC_LIMIT ||
+        positional_count > UPPER_ARGC_LIMIT) {
         fprintf(stdout, PARAMETERS_COUNT_MSG);
         return EXIT_FAILURE;
     }
+    TweetOptions options;
+    if (parse_options(argc, argv, positional_count, &options)) {
+        fprintf(stdout, OPTIONS_MSG);
+        return EXIT_FAILURE;
+    }
+    if (options.min_count != NO_INPUT && options.sketch_memory == 0) {
+        fprintf(stdout, MIN_COUNT_MSG);
+        return EXIT_FAILURE;
+    }
+    if (!are_beam_options_valid(&options)) {
+        fprintf(stdout, BEAM_OPTIONS_ERROR);
+        return EXIT_FAILURE;
+    }
+    if (options.target_word && has_sampling_controls(&options)) {
+        fprintf(stdout, CONSTRAINT_OPTIONS_ERROR);
+        return EXIT_FAILURE;
+    }
     //reading argv:
     unsigned int seed = strtol(argv[1], NULL, DECIMAL_BASE);
-    long tweets_num = strtol(argv[2], NULL, DECIMAL_BASE);
+    int tweets_count;
+    if (!parse_int_option(argv[2], 0, &tweets_count)) {
+        fprintf(stdout, TWEETS_COUNT_MSG);
+        return EXIT_FAILURE;
+    }
+    long tweets_num = tweets_count;
     char *file_path = argv[3];
     long file_words_num = NO_INPUT;
 
     srand(seed);
 
-    if (argc == UPPER_ARGC_LIMIT) {
+    if (positional_count == UPPER_ARGC_LIMIT) {
         file_words_num = strtol(argv[4], NULL, DECIMAL_BASE);
     }
 
@@ -151,6 +944,13 @@ int main(int argc, char *argv[]) {
         fprintf(stdout, DATABASE_ALLOCATION_FAILURE);
         return EXIT_FAILURE;
     }
+    vocabulary = create_vocabulary();
+    if (!vocabulary) {
+        free(tmp);
+        free(markov_chain);
+        fprintf(stdout, ALLOCATION_ERROR_MASSAGE);
+        return EXIT_FAILURE;
+    }
     markov_chain->database = tmp;
     markov_chain->database->first = NULL;
     markov_chain->database->last = NULL;
@@ -162,11 +962,47 @@ int main(int argc, char *argv[]) {
     markov_chain->free_data = &free_word;
     markov_chain->is_last = &is_last_word;
 
-    //fill database with file data:
-    if (fill_database(file,(int)file_words_num , markov_chain)) {
-      free_markov_chain (&markov_chain);
+    //fill database with file data, or load it if the file is a saved model:
+    CopyFilter *copy_filter = NULL;
+    if (is_saved_model(file)) {
+        if (options.copy_filter_rate != 0 || options.copy_filter_memory != 0) {
+            fclose(file);
+            fprintf(stdout, COPY_FILTER_MODEL_ERROR);
+            free_tweets_chain(&markov_chain);
+            return EXIT_FAILURE;
+        }
+        if (!load_markov_chain(markov_chain, file, &word_data)) {
+            fclose(file);
+            fprintf(stdout, MODEL_FORMAT_ERROR);
+            free_tweets_chain(&markov_chain);
+            return EXIT_FAILURE;
+        }
+        if (!has_first_node(markov_chain)) {
+            fclose(file);
+            fprintf(stdout, NO_FIRST_WORD_ERROR);
+            free_tweets_chain(&markov_chain);
+            return EXIT_FAILURE;
+        }
+    } else if (create_tweets_copy_filter(file, (int) file_words_num, &options,
+                                         &copy_filter) ||
+               train_chain(file, (int) file_words_num, markov_chain,
+                           &options, copy_filter)) {
+      fclose(file);
+      free_copy_filter(&copy_filter);
+      free_tweets_chain(&markov_chain);
       return EXIT_FAILURE;
     }
+    fclose(file);
+    compact_vocabulary(vocabulary);
+    if (copy_filter) {
+        print_copy_filter(copy_filter);
+    }
+    if (options.save_path &&
+        save_model(markov_chain, options.save_path, options.front_coded)) {
+        free_copy_filter(&copy_filter);
+        free_tweets_chain(&markov_chain);
+        return EXIT_FAILURE;
+    }
 //    printf("%d", count_markov_chain (markov_chain));
 
 
@@ -176,19 +1012,14 @@ int main(int argc, char *argv[]) {
 //        tmp2 = tmp2->next;
 //    }
     //create tweet:
-    int count = 1;
-//    char start[TWEET_START_SIZE];
-    while(count <= tweets_num)
-    {
-      MarkovNode *first_node = get_first_random_node (markov_chain);
-//      sprintf(start, "Tweet %d: ", count);
-      fprintf(stdout, "Tweet %d: ",count);
-      generate_random_sequence (markov_chain, first_node, SEQUENCE_MAX_LENGTH);
-      fprintf(stdout, "\n");
-      count ++;
+    if (create_tweets(markov_chain, tweets_num, &options, copy_filter)) {
+        free_copy_filter(&copy_filter);
+        free_tweets_chain(&markov_chain);
+        return EXIT_FAILURE;
     }
 
     //free markov chain:
-    free_markov_chain(&markov_chain);
+    free_copy_filter(&copy_filter);
+    free_tweets_chain(&markov_chain);
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "vocabulary.h"
+#include <string.h>
+
+#define FIRST_POOL_CAPACITY 4096
+#define FIRST_WORDS_CAPACITY 256
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+
+/**
+ * Create an empty vocabulary.
+ * @return newly allocated vocabulary, NULL in case of allocation failure
+ */
+Vocabulary *create_vocabulary(void) {
+    Vocabulary *vocabulary = calloc(1, sizeof(Vocabulary));
+    if (!vocabulary) {
+        return NULL;
+    }
+    vocabulary->pool = malloc(FIRST_POOL_CAPACITY);
+    vocabulary->offsets = malloc(sizeof(uint32_t) * FIRST_WORDS_CAPACITY);
+    vocabulary->table = calloc(2 * FIRST_WORDS_CAPACITY, sizeof(int));
+    if (!vocabulary->pool || !vocabulary->offsets || !vocabulary->table) {
+        free_vocabulary(&vocabulary);
+        return NULL;
+    }
+    vocabulary->pool_capacity = FIRST_POOL_CAPACITY;
+    vocabulary->words_capacity = FIRST_WORDS_CAPACITY;
+    vocabulary->table_capacity = 2 * FIRST_WORDS_CAPACITY;
+    return vocabulary;
+}
+
+
+/**
+ * Free vocabulary and all of it's content from memory.
+ * @param vocabulary vocabulary to free
+ */
+void free_vocabulary(Vocabulary **ptr_vocabulary) {
+    Vocabulary *vocabulary = *ptr_vocabulary;
+    if (!vocabulary) {
+        return;
+    }
+    free(vocabulary->pool);
+    free(vocabulary->offsets);
+    free(vocabulary->table);
+    free(vocabulary);
+    *ptr_vocabulary = NULL;
+}
+
+
+static uint32_t hash_word(const char *word) {
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (const char *c = word; *c; c++) {
+        hash = (hash ^ (unsigned char) *c) * FNV_PRIME;
+    }
+    return hash;
+}
+
+
+/**
+ * Find the slot of word in the hash table: the slot holding it, or the empty
+ * slot it would be added in.
+ */
+static int find_slot(const Vocabulary *vocabulary, const char *word,
+                     uint32_t hash) {
+    int mask = vocabulary->table_capacity - 1;
+    int slot = (int) (hash & mask);
+    while (vocabulary->table[slot] != 0 &&
+           strcmp(word_of_id(vocabulary, vocabulary->table[slot] - 1),
+                  word) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+
+/**
+ * Double the hash table and add all the words to it again.
+ * @return true on success, false in case of allocation failure
+ */
+static bool grow_table(Vocabulary *vocabulary) {
+    int capacity = 2 * vocabulary->table_capacity;
+    int *table = calloc(capacity, sizeof(int));
+    if (!table) {
+        return false;
+    }
+    free(vocabulary->table);
+    vocabulary->table = table;
+    vocabulary->table_capacity = capacity;
+    for (int id = 0; id < vocabulary->words_count; id++) {
+        const char *word = word_of_id(vocabulary, id);
+        table[find_slot(vocabulary, word, hash_word(word))] = id + 1;
+    }
+    return true;
+}
+
+
+/**
+ * Make room for one more word of length bytes (with it's '\0').
+ * @return true on success, false in case of allocation failure
+ */
+static bool reserve_word(Vocabulary *vocabulary, size_t length) {
+    if (vocabulary->pool_size + length > UINT32_MAX ||
+        vocabulary->words_count == INT32_MAX / 4) {
+        return false;
+    }
+    if (vocabulary->pool_size + length > vocabulary->pool_capacity) {
+        size_t capacity = 2 * vocabulary->pool_capacity;
+        while (vocabulary->pool_size + length > capacity) {
+            capacity *= 2;
+        }
+        char *pool = realloc(vocabulary->pool, capacity);
+        if (!pool) {
+            return false;
+        }
+        vocabulary->pool = pool;
+        vocabulary->pool_capacity = capacity;
+    }
+    if (vocabulary->words_count == vocabulary->words_capacity) {
+        int capacity = 2 * vocabulary->words_capacity;
+        uint32_t *offsets = realloc(vocabulary->offsets,
+                                    sizeof(uint32_t) * capacity);
+        if (!offsets) {
+            return false;
+        }
+        vocabulary->offsets = offsets;
+        vocabulary->words_capacity = capacity;
+    }
+    // at most 3/4 of the slots are used
+    return 4 * ((size_t) vocabulary->words_count + 1) <=
+           3 * (size_t) vocabulary->table_capacity || grow_table(vocabulary);
+}
+
+
+/**
+ * Get the id of word, adding it to the vocabulary if it is not there.
+ * @param vocabulary
+ * @param word
+ * @return id of word, -1 in case of allocation failure
+ */
+int intern_word(Vocabulary *vocabulary, const char *word) {
+    uint32_t hash = hash_word(word);
+    int slot = find_slot(vocabulary, word, hash);
+    if (vocabulary->table[slot] != 0) {
+        return vocabulary->table[slot] - 1;
+    }
+    size_t length = strlen(word) + 1;
+    int table_capacity = vocabulary->table_capacity;
+    if (!reserve_word(vocabulary, length)) {
+        return -1;
+    }
+    if (vocabulary->table_capacity != table_capacity) {
+        slot = find_slot(vocabulary, word, hash); // the table has grown
+    }
+    int id = vocabulary->words_count++;
+    vocabulary->offsets[id] = (uint32_t) vocabulary->pool_size;
+    memcpy(vocabulary->pool + vocabulary->pool_size, word, length);
+    vocabulary->pool_size += length;
+    vocabulary->table[slot] = id + 1;
+    return id;
+}
+
+
+/**
+ * Free the memory vocabulary reserved for words it didn't get, after all the
+ * words were added. More words can still be added afterwards.
+ * @param vocabulary
+ */
+void compact_vocabulary(Vocabulary *vocabulary) {
+    // on failure the bigger blocks are kept, which is harmless
+    char *pool = realloc(vocabulary->pool, vocabulary->pool_size + 1);
+    if (pool) {
+        vocabulary->pool = pool;
+        vocabulary->pool_capacity = vocabulary->pool_size + 1;
+    }
+    int words_capacity = vocabulary->words_count + 1;
+    uint32_t *offsets = realloc(vocabulary->offsets,
+                                sizeof(uint32_t) * words_capacity);
+    if (offsets) {
+        vocabulary->offsets = offsets;
+        vocabulary->words_capacity = words_capacity;
+    }
+}
+
+
+/**
+ * Get the id of word.
+ * @param vocabulary
+ * @param word
+ * @return id of word, -1 if word is not in the vocabulary
+ */
+int find_word(const Vocabulary *vocabulary, const char *word) {
+    return vocabulary->table[find_slot(vocabulary, word, hash_word(word))] - 1;
+}
+
+
+/**
+ * Get the word of an id. The string moves when words are added, so it must
+ * not be kept after the next intern_word.
+ * @param vocabulary
+ * @param id id of a word in the vocabulary
+ * @return the word
+ */
+const char *word_of_id(const Vocabulary *vocabulary, int id) {
+    return vocabulary->pool + vocabulary->offsets[id];
+}
+
+
+/**
+ * Memory used by vocabulary: the pool, the offsets and the hash table.
+ * @param vocabulary
+ * @return size in bytes
+ */
+size_t vocabulary_memory(const Vocabulary *vocabulary) {
+    return sizeof(Vocabulary) + vocabulary->pool_capacity +
+           sizeof(uint32_t) * vocabulary->words_capacity +
+           sizeof(int) * vocabulary->table_capacity;
+}
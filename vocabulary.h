@@ -0,0 +1,80 @@
+#ifndef _VOCABULARY_H
+#define _VOCABULARY_H
+
+#include <stdlib.h>
+#include <stdbool.h> // for bool
+#include <stdint.h> // For uint32_t, intptr_t
+
+/* The id of a word is kept as generic data by adding 1 to it, so that no
+ * word is NULL (which copy_func returns on allocation failure). */
+#define WORD_ID_TO_DATA(id) ((void *) (intptr_t) ((id) + 1))
+#define DATA_TO_WORD_ID(data) ((int) ((intptr_t) (data) - 1))
+
+/**
+ * Interned words: every distinct word is kept once, in a single pool of
+ * '\0' terminated strings, and is known by it's id, the order it was added
+ * in. A hash table (open addressing) finds the id of a word.
+ */
+typedef struct Vocabulary {
+    char *pool;
+    size_t pool_size;
+    size_t pool_capacity;
+    uint32_t *offsets; // offset in pool of the word of every id
+    int words_count;
+    int words_capacity;
+    int *table;        // id + 1 of the words, 0 for an empty slot
+    int table_capacity; // a power of 2, at most 3/4 full
+} Vocabulary;
+
+/**
+ * Create an empty vocabulary.
+ * @return newly allocated vocabulary, NULL in case of allocation failure
+ */
+Vocabulary *create_vocabulary(void);
+
+/**
+ * Free vocabulary and all of it's content from memory.
+ * @param vocabulary vocabulary to free
+ */
+void free_vocabulary(Vocabulary **vocabulary);
+
+/**
+ * Get the id of word, adding it to the vocabulary if it is not there.
+ * @param vocabulary
+ * @param word
+ * @return id of word, -1 in case of allocation failure
+ */
+int intern_word(Vocabulary *vocabulary, const char *word);
+
+/**
+ * Free the memory vocabulary reserved for words it didn't get, after all the
+ * words were added. More words can still be added afterwards.
+ * @param vocabulary
+ */
+void compact_vocabulary(Vocabulary *vocabulary);
+
+/**
+ * Get the id of word.
+ * @param vocabulary
+ * @param word
+ * @return id of word, -1 if word is not in the vocabulary
+ */
+int find_word(const Vocabulary *vocabulary, const char *word);
+
+/**
+ * Get the word of an id. The string moves when words are added, so it must
+ * not be kept after the next intern_word.
+ * @param vocabulary
+ * @param id id of a word in the vocabulary
+ * @return the word
+ */
+const char *word_of_id(const Vocabulary *vocabulary, int id);
+
+/**
+ * Memory used by vocabulary: the pool, the offsets and the hash table.
+ * @param vocabulary
+ * @return size in bytes
+ */
+size_t vocabulary_memory(const Vocabulary *vocabulary);
+
+#endif /* _VOCABULARY_H */